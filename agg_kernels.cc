@@ -0,0 +1,750 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+#include <bitset>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "agg_kernels.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define AGG_X86_SIMD 1
+#include <immintrin.h>
+#define AGG_TARGET_AVX2 __attribute__((target("avx2")))
+#define AGG_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define AGG_X86_SIMD 0
+#endif
+
+/*
+ * What one pass over a run of values learns about it. The *Run() functions
+ * decide from it whether the run can be folded into the accumulator at once
+ * or has to be replayed through the scalar kernel.
+ */
+struct SumParts {
+  uint64_t pos;     // sum of the non-negative values
+  uint64_t neg;     // sum of the magnitudes of the negative values
+  double dsum;
+  double dabs;      // sum of the absolute values
+  bool overflow;    // pos or neg wrapped around
+  bool any;         // at least one non-NULL value
+};
+
+struct ExtremeParts {
+  DataValue value;
+  bool any;
+  bool nan;
+};
+
+typedef void (*SumPartsFn)(const void* vals, const bool* is_null,
+                           uint32_t n, SumParts* parts);
+typedef void (*ExtremePartsFn)(const void* vals, const bool* is_null,
+                               uint32_t n, ExtremeParts* parts);
+
+struct RunKernels {
+  SumPartsFn sum_int64;
+  SumPartsFn sum_uint64;
+  SumPartsFn sum_double;
+  ExtremePartsFn min_int64;
+  ExtremePartsFn min_uint64;
+  ExtremePartsFn min_double;
+  ExtremePartsFn max_int64;
+  ExtremePartsFn max_uint64;
+  ExtremePartsFn max_double;
+};
+
+inline bool IsNull(const bool* is_null, uint32_t i) {
+  return is_null != nullptr && is_null[i];
+}
+
+/*
+ * All ones if value i isn't NULL, else 0, to mask it out without a branch.
+ */
+inline uint64_t ValidMask(const bool* is_null, uint32_t i) {
+  return 0 - static_cast<uint64_t>(!IsNull(is_null, i));
+}
+
+inline void AddMagnitude(uint64_t v, uint64_t* acc, bool* overflow) {
+  *overflow |= (ULLONG_MAX - *acc < v);
+  *acc += v;
+}
+
+/*
+ * Scalar passes, also used for the tails of the SIMD ones. A NULL value is
+ * masked to 0, or not taken, rather than branched over.
+ */
+void SumInt64Scalar(const void* p, const bool* is_null, uint32_t n,
+                    SumParts* parts) {
+  const int64_t* vals = static_cast<const int64_t*>(p);
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t valid = ValidMask(is_null, i);
+    uint64_t neg = 0 - static_cast<uint64_t>(vals[i] < 0);
+    // |vals[i]|, two's complement negation where negative.
+    uint64_t mag = ((static_cast<uint64_t>(vals[i]) ^ neg) - neg) & valid;
+    AddMagnitude(mag & neg, &parts->neg, &parts->overflow);
+    AddMagnitude(mag & ~neg, &parts->pos, &parts->overflow);
+    parts->any |= valid != 0;
+  }
+}
+
+void SumUint64Scalar(const void* p, const bool* is_null, uint32_t n,
+                     SumParts* parts) {
+  const uint64_t* vals = static_cast<const uint64_t*>(p);
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t valid = ValidMask(is_null, i);
+    AddMagnitude(vals[i] & valid, &parts->pos, &parts->overflow);
+    parts->any |= valid != 0;
+  }
+}
+
+void SumDoubleScalar(const void* p, const bool* is_null, uint32_t n,
+                     SumParts* parts) {
+  const double* vals = static_cast<const double*>(p);
+  for (uint32_t i = 0; i < n; i++) {
+    bool valid = !IsNull(is_null, i);
+    // Selected, not multiplied, a NULL may hold a NaN.
+    double val = valid ? vals[i] : 0;
+    parts->dsum += val;
+    parts->dabs += std::fabs(val);
+    parts->any |= valid;
+  }
+}
+
+template <typename T, bool kMin>
+void ExtremeScalar(const void* p, const bool* is_null, uint32_t n,
+                   ExtremeParts* parts) {
+  const T* vals = static_cast<const T*>(p);
+  T best;
+  memcpy(&best, &parts->value, sizeof(T));
+  for (uint32_t i = 0; i < n; i++) {
+    bool valid = !IsNull(is_null, i);
+    bool better = !parts->any || (kMin ? vals[i] < best : vals[i] > best);
+    best = (valid & better) ? vals[i] : best;
+    parts->nan |= valid & (vals[i] != vals[i]);
+    parts->any |= valid;
+  }
+  memcpy(&parts->value, &best, sizeof(T));
+}
+
+const RunKernels kScalarKernels = {
+  SumInt64Scalar,
+  SumUint64Scalar,
+  SumDoubleScalar,
+  ExtremeScalar<int64_t, true>,
+  ExtremeScalar<uint64_t, true>,
+  ExtremeScalar<double, true>,
+  ExtremeScalar<int64_t, false>,
+  ExtremeScalar<uint64_t, false>,
+  ExtremeScalar<double, false>
+};
+
+#if AGG_X86_SIMD
+/*
+ * Folds the lanes of a SIMD pass into |parts|.
+ */
+void MergeSumLanes(const uint64_t* pos, const uint64_t* neg, uint32_t lanes,
+                   bool overflow, bool any, SumParts* parts) {
+  for (uint32_t i = 0; i < lanes; i++) {
+    AddMagnitude(pos[i], &parts->pos, &parts->overflow);
+    AddMagnitude(neg[i], &parts->neg, &parts->overflow);
+  }
+  parts->overflow |= overflow;
+  parts->any |= any;
+}
+
+/*
+ * AVX2, 4 lanes of 64 bits.
+ */
+AGG_TARGET_AVX2
+static inline __m256i ValidMask4(const bool* is_null, uint32_t i) {
+  if (is_null == nullptr) {
+    return _mm256_set1_epi64x(-1);
+  }
+  int32_t bytes;
+  memcpy(&bytes, is_null + i, sizeof(bytes));
+  __m256i nulls = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(bytes));
+  return _mm256_cmpeq_epi64(nulls, _mm256_setzero_si256());
+}
+
+// Unsigned a < b.
+AGG_TARGET_AVX2
+static inline __m256i LessU64x4(__m256i a, __m256i b) {
+  const __m256i sign = _mm256_set1_epi64x(LLONG_MIN);
+  return _mm256_cmpgt_epi64(_mm256_xor_si256(b, sign),
+                            _mm256_xor_si256(a, sign));
+}
+
+template <bool kSigned>
+AGG_TARGET_AVX2
+void SumIntAvx2(const void* p, const bool* is_null, uint32_t n,
+                SumParts* parts) {
+  const int64_t* vals = static_cast<const int64_t*>(p);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i pos = zero;
+  __m256i neg = zero;
+  __m256i overflow = zero;
+  __m256i any = zero;
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i valid = ValidMask4(is_null, i);
+    __m256i v = _mm256_and_si256(valid,
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(vals + i)));
+    __m256i p_part = v;
+    if (kSigned) {
+      __m256i is_neg = _mm256_cmpgt_epi64(zero, v);
+      __m256i n_part = _mm256_and_si256(is_neg, _mm256_sub_epi64(zero, v));
+      p_part = _mm256_andnot_si256(is_neg, v);
+      neg = _mm256_add_epi64(neg, n_part);
+      overflow = _mm256_or_si256(overflow, LessU64x4(neg, n_part));
+    }
+    pos = _mm256_add_epi64(pos, p_part);
+    overflow = _mm256_or_si256(overflow, LessU64x4(pos, p_part));
+    any = _mm256_or_si256(any, valid);
+  }
+  uint64_t pos_lanes[4];
+  uint64_t neg_lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(pos_lanes), pos);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(neg_lanes), neg);
+  MergeSumLanes(pos_lanes, neg_lanes, 4,
+                !_mm256_testz_si256(overflow, overflow),
+                !_mm256_testz_si256(any, any), parts);
+  if (kSigned) {
+    SumInt64Scalar(vals + i, is_null ? is_null + i : nullptr, n - i, parts);
+  } else {
+    SumUint64Scalar(vals + i, is_null ? is_null + i : nullptr, n - i, parts);
+  }
+}
+
+AGG_TARGET_AVX2
+void SumDoubleAvx2(const void* p, const bool* is_null, uint32_t n,
+                   SumParts* parts) {
+  const double* vals = static_cast<const double*>(p);
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  __m256d sum = _mm256_setzero_pd();
+  __m256d abs_sum = _mm256_setzero_pd();
+  __m256i any = _mm256_setzero_si256();
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i valid = ValidMask4(is_null, i);
+    __m256d v = _mm256_and_pd(_mm256_castsi256_pd(valid),
+                              _mm256_loadu_pd(vals + i));
+    sum = _mm256_add_pd(sum, v);
+    abs_sum = _mm256_add_pd(abs_sum, _mm256_andnot_pd(sign, v));
+    any = _mm256_or_si256(any, valid);
+  }
+  double lanes[4];
+  double abs_lanes[4];
+  _mm256_storeu_pd(lanes, sum);
+  _mm256_storeu_pd(abs_lanes, abs_sum);
+  if (!_mm256_testz_si256(any, any)) {
+    parts->dsum += ((lanes[0] + lanes[1]) + lanes[2]) + lanes[3];
+    parts->dabs += ((abs_lanes[0] + abs_lanes[1]) + abs_lanes[2]) +
+                   abs_lanes[3];
+    parts->any = true;
+  }
+  SumDoubleScalar(vals + i, is_null ? is_null + i : nullptr, n - i, parts);
+}
+
+template <bool kMin, bool kSigned>
+AGG_TARGET_AVX2
+void ExtremeIntAvx2(const void* p, const bool* is_null, uint32_t n,
+                    ExtremeParts* parts) {
+  typedef typename std::conditional<kSigned, int64_t, uint64_t>::type T;
+  const T* vals = static_cast<const T*>(p);
+  const T identity = kMin ? std::numeric_limits<T>::max() :
+                            std::numeric_limits<T>::min();
+  const __m256i sign = _mm256_set1_epi64x(kSigned ? 0 : LLONG_MIN);
+  __m256i best = _mm256_set1_epi64x(static_cast<int64_t>(identity));
+  __m256i any = _mm256_setzero_si256();
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i valid = ValidMask4(is_null, i);
+    __m256i v = _mm256_blendv_epi8(best,
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(vals + i)), valid);
+    // Compare as signed after flipping the sign bit of unsigned values.
+    __m256i vs = _mm256_xor_si256(v, sign);
+    __m256i bs = _mm256_xor_si256(best, sign);
+    __m256i take = kMin ? _mm256_cmpgt_epi64(bs, vs) :
+                          _mm256_cmpgt_epi64(vs, bs);
+    best = _mm256_blendv_epi8(best, v, take);
+    any = _mm256_or_si256(any, valid);
+  }
+  if (!_mm256_testz_si256(any, any)) {
+    T lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), best);
+    ExtremeScalar<T, kMin>(lanes, nullptr, 4, parts);
+  }
+  ExtremeScalar<T, kMin>(vals + i, is_null ? is_null + i : nullptr, n - i,
+                         parts);
+}
+
+template <bool kMin>
+AGG_TARGET_AVX2
+void ExtremeDoubleAvx2(const void* p, const bool* is_null, uint32_t n,
+                       ExtremeParts* parts) {
+  const double* vals = static_cast<const double*>(p);
+  const double identity = kMin ? HUGE_VAL : -HUGE_VAL;
+  __m256d best = _mm256_set1_pd(identity);
+  __m256d nan = _mm256_setzero_pd();
+  __m256i any = _mm256_setzero_si256();
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i valid = ValidMask4(is_null, i);
+    __m256d v = _mm256_blendv_pd(_mm256_set1_pd(identity),
+                                 _mm256_loadu_pd(vals + i),
+                                 _mm256_castsi256_pd(valid));
+    nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+    // (v < best) ? v : best, the same way the scalar kernel picks.
+    best = kMin ? _mm256_min_pd(v, best) : _mm256_max_pd(v, best);
+    any = _mm256_or_si256(any, valid);
+  }
+  if (!_mm256_testz_si256(any, any)) {
+    double lanes[4];
+    _mm256_storeu_pd(lanes, best);
+    ExtremeScalar<double, kMin>(lanes, nullptr, 4, parts);
+    parts->nan |= !_mm256_testz_pd(nan, nan);
+  }
+  ExtremeScalar<double, kMin>(vals + i, is_null ? is_null + i : nullptr,
+                              n - i, parts);
+}
+
+const RunKernels kAvx2Kernels = {
+  SumIntAvx2<true>,
+  SumIntAvx2<false>,
+  SumDoubleAvx2,
+  ExtremeIntAvx2<true, true>,
+  ExtremeIntAvx2<true, false>,
+  ExtremeDoubleAvx2<true>,
+  ExtremeIntAvx2<false, true>,
+  ExtremeIntAvx2<false, false>,
+  ExtremeDoubleAvx2<false>
+};
+
+/*
+ * AVX-512, 8 lanes of 64 bits with mask registers.
+ */
+AGG_TARGET_AVX512
+static inline __mmask8 ValidMask8(const bool* is_null, uint32_t i) {
+  if (is_null == nullptr) {
+    return 0xFF;
+  }
+  __m512i nulls = _mm512_cvtepu8_epi64(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(is_null + i)));
+  return _mm512_testn_epi64_mask(nulls, nulls);
+}
+
+template <bool kSigned>
+AGG_TARGET_AVX512
+void SumIntAvx512(const void* p, const bool* is_null, uint32_t n,
+                  SumParts* parts) {
+  const int64_t* vals = static_cast<const int64_t*>(p);
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i pos = zero;
+  __m512i neg = zero;
+  __mmask8 overflow = 0;
+  __mmask8 any = 0;
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __mmask8 valid = ValidMask8(is_null, i);
+    __m512i v = _mm512_maskz_loadu_epi64(valid, vals + i);
+    __m512i p_part = v;
+    if (kSigned) {
+      __mmask8 is_neg = _mm512_cmplt_epi64_mask(v, zero);
+      __m512i n_part = _mm512_maskz_sub_epi64(is_neg, zero, v);
+      p_part = _mm512_maskz_mov_epi64(static_cast<__mmask8>(~is_neg), v);
+      neg = _mm512_add_epi64(neg, n_part);
+      overflow |= _mm512_cmplt_epu64_mask(neg, n_part);
+    }
+    pos = _mm512_add_epi64(pos, p_part);
+    overflow |= _mm512_cmplt_epu64_mask(pos, p_part);
+    any |= valid;
+  }
+  uint64_t pos_lanes[8];
+  uint64_t neg_lanes[8];
+  _mm512_storeu_si512(pos_lanes, pos);
+  _mm512_storeu_si512(neg_lanes, neg);
+  MergeSumLanes(pos_lanes, neg_lanes, 8, overflow != 0, any != 0, parts);
+  if (kSigned) {
+    SumInt64Scalar(vals + i, is_null ? is_null + i : nullptr, n - i, parts);
+  } else {
+    SumUint64Scalar(vals + i, is_null ? is_null + i : nullptr, n - i, parts);
+  }
+}
+
+AGG_TARGET_AVX512
+void SumDoubleAvx512(const void* p, const bool* is_null, uint32_t n,
+                     SumParts* parts) {
+  const double* vals = static_cast<const double*>(p);
+  __m512d sum = _mm512_setzero_pd();
+  __m512d abs_sum = _mm512_setzero_pd();
+  __mmask8 any = 0;
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __mmask8 valid = ValidMask8(is_null, i);
+    __m512d v = _mm512_maskz_loadu_pd(valid, vals + i);
+    sum = _mm512_add_pd(sum, v);
+    abs_sum = _mm512_add_pd(abs_sum, _mm512_abs_pd(v));
+    any |= valid;
+  }
+  double lanes[8];
+  double abs_lanes[8];
+  _mm512_storeu_pd(lanes, sum);
+  _mm512_storeu_pd(abs_lanes, abs_sum);
+  if (any) {
+    double sum_lo = ((lanes[0] + lanes[1]) + lanes[2]) + lanes[3];
+    double sum_hi = ((lanes[4] + lanes[5]) + lanes[6]) + lanes[7];
+    double abs_lo = ((abs_lanes[0] + abs_lanes[1]) + abs_lanes[2]) +
+                    abs_lanes[3];
+    double abs_hi = ((abs_lanes[4] + abs_lanes[5]) + abs_lanes[6]) +
+                    abs_lanes[7];
+    parts->dsum += sum_lo + sum_hi;
+    parts->dabs += abs_lo + abs_hi;
+    parts->any = true;
+  }
+  SumDoubleScalar(vals + i, is_null ? is_null + i : nullptr, n - i, parts);
+}
+
+template <bool kMin, bool kSigned>
+AGG_TARGET_AVX512
+void ExtremeIntAvx512(const void* p, const bool* is_null, uint32_t n,
+                      ExtremeParts* parts) {
+  typedef typename std::conditional<kSigned, int64_t, uint64_t>::type T;
+  const T* vals = static_cast<const T*>(p);
+  const T identity = kMin ? std::numeric_limits<T>::max() :
+                            std::numeric_limits<T>::min();
+  __m512i best = _mm512_set1_epi64(static_cast<int64_t>(identity));
+  __mmask8 any = 0;
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __mmask8 valid = ValidMask8(is_null, i);
+    __m512i v = _mm512_loadu_si512(vals + i);
+    if (kSigned) {
+      best = kMin ? _mm512_mask_min_epi64(best, valid, best, v) :
+                    _mm512_mask_max_epi64(best, valid, best, v);
+    } else {
+      best = kMin ? _mm512_mask_min_epu64(best, valid, best, v) :
+                    _mm512_mask_max_epu64(best, valid, best, v);
+    }
+    any |= valid;
+  }
+  if (any) {
+    T lanes[8];
+    _mm512_storeu_si512(lanes, best);
+    ExtremeScalar<T, kMin>(lanes, nullptr, 8, parts);
+  }
+  ExtremeScalar<T, kMin>(vals + i, is_null ? is_null + i : nullptr, n - i,
+                         parts);
+}
+
+template <bool kMin>
+AGG_TARGET_AVX512
+void ExtremeDoubleAvx512(const void* p, const bool* is_null, uint32_t n,
+                         ExtremeParts* parts) {
+  const double* vals = static_cast<const double*>(p);
+  __m512d best = _mm512_set1_pd(kMin ? HUGE_VAL : -HUGE_VAL);
+  __mmask8 nan = 0;
+  __mmask8 any = 0;
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __mmask8 valid = ValidMask8(is_null, i);
+    __m512d v = _mm512_loadu_pd(vals + i);
+    nan |= _mm512_mask_cmp_pd_mask(valid, v, v, _CMP_UNORD_Q);
+    // (v < best) ? v : best, the same way the scalar kernel picks.
+    best = kMin ? _mm512_mask_min_pd(best, valid, v, best) :
+                  _mm512_mask_max_pd(best, valid, v, best);
+    any |= valid;
+  }
+  if (any) {
+    double lanes[8];
+    _mm512_storeu_pd(lanes, best);
+    ExtremeScalar<double, kMin>(lanes, nullptr, 8, parts);
+    parts->nan |= (nan != 0);
+  }
+  ExtremeScalar<double, kMin>(vals + i, is_null ? is_null + i : nullptr,
+                              n - i, parts);
+}
+
+const RunKernels kAvx512Kernels = {
+  SumIntAvx512<true>,
+  SumIntAvx512<false>,
+  SumDoubleAvx512,
+  ExtremeIntAvx512<true, true>,
+  ExtremeIntAvx512<true, false>,
+  ExtremeDoubleAvx512<true>,
+  ExtremeIntAvx512<false, true>,
+  ExtremeIntAvx512<false, false>,
+  ExtremeDoubleAvx512<false>
+};
+#endif  // AGG_X86_SIMD
+
+SimdLevel DetectSimdLevel() {
+#if AGG_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return kSimdAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return kSimdAvx2;
+  }
+#endif
+  return kSimdScalar;
+}
+
+static SimdLevel g_simd_level = DetectSimdLevel();
+
+SimdLevel GetSimdLevel() {
+  return g_simd_level;
+}
+
+void SetSimdLevel(SimdLevel level) {
+  SimdLevel detected = DetectSimdLevel();
+  g_simd_level = level < detected ? level : detected;
+}
+
+const RunKernels* Kernels() {
+#if AGG_X86_SIMD
+  switch (g_simd_level) {
+    case kSimdAvx512:
+      return &kAvx512Kernels;
+    case kSimdAvx2:
+      return &kAvx2Kernels;
+    default:
+      break;
+  }
+#endif
+  return &kScalarKernels;
+}
+
+/*
+ * Feeds values [begin, end) of the run to the per-row kernel one at a time.
+ */
+int32_t ScalarRun(int32_t (*kernel)(const Register&, AggResItem*),
+                  const void* vals, DataType type, bool is_unsigned,
+                  const bool* is_null, uint32_t begin, uint32_t end,
+                  AggResItem* res) {
+  const DataValue* values = static_cast<const DataValue*>(vals);
+  Register reg;
+  reg.type = type;
+  reg.is_unsigned = is_unsigned;
+  for (uint32_t i = begin; i < end; i++) {
+    reg.value = values[i];
+    reg.is_null = IsNull(is_null, i);
+    if (kernel(reg, res) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int32_t SumInt64Run(const int64_t* vals, const bool* is_null, uint32_t n,
+                    AggResItem* res) {
+  if (res->type != kTypeBigInt || res->is_unsigned) {
+    return ScalarRun(Sum, vals, kTypeBigInt, false, is_null, 0, n, res);
+  }
+  SumParts parts;
+  memset(&parts, 0, sizeof(parts));
+  Kernels()->sum_int64(vals, is_null, n, &parts);
+  if (!parts.any) {
+    return 0;
+  }
+  /*
+   * Every prefix sum lies in [acc - neg, acc + pos], so if both ends fit in
+   * BIGINT none of the additions the scalar kernel does can overflow.
+   * Otherwise let the scalar kernel find out where it overflows.
+   */
+  uint64_t acc = res->value.val_uint64;
+  uint64_t room_up = static_cast<uint64_t>(LLONG_MAX) - acc;
+  uint64_t room_down = acc - static_cast<uint64_t>(LLONG_MIN);
+  if (parts.overflow || parts.pos > room_up || parts.neg > room_down) {
+    return ScalarRun(Sum, vals, kTypeBigInt, false, is_null, 0, n, res);
+  }
+  res->value.val_uint64 = acc + parts.pos - parts.neg;
+  return 0;
+}
+
+int32_t SumUint64Run(const uint64_t* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res) {
+  if (res->type != kTypeBigInt ||
+      (!res->is_unsigned && res->value.val_int64 < 0)) {
+    return ScalarRun(Sum, vals, kTypeBigInt, true, is_null, 0, n, res);
+  }
+  SumParts parts;
+  memset(&parts, 0, sizeof(parts));
+  Kernels()->sum_uint64(vals, is_null, n, &parts);
+  if (!parts.any) {
+    return 0;
+  }
+  uint64_t acc = res->value.val_uint64;
+  if (parts.overflow || ULLONG_MAX - acc < parts.pos) {
+    return ScalarRun(Sum, vals, kTypeBigInt, true, is_null, 0, n, res);
+  }
+  res->value.val_uint64 = acc + parts.pos;
+  res->is_unsigned = true;
+  return 0;
+}
+
+int32_t SumDoubleRun(const double* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res) {
+  if (res->type != kTypeDouble) {
+    return ScalarRun(Sum, vals, kTypeDouble, false, is_null, 0, n, res);
+  }
+  SumParts parts;
+  memset(&parts, 0, sizeof(parts));
+  Kernels()->sum_double(vals, is_null, n, &parts);
+  if (!parts.any) {
+    return 0;
+  }
+  /*
+   * Every partial sum the scalar kernel would see is bounded by
+   * |acc| + sum(|v|). Far enough from DBL_MAX none of them can overflow in
+   * either order, otherwise replay the run to overflow where it would.
+   */
+  double bound = std::fabs(res->value.val_double) + parts.dabs;
+  if (!(bound < std::numeric_limits<double>::max() / 2)) {
+    return ScalarRun(Sum, vals, kTypeDouble, false, is_null, 0, n, res);
+  }
+  double res_val = res->value.val_double + parts.dsum;
+  res->value.val_double = res_val;
+  res->is_unsigned = false;
+  return 0;
+}
+
+/*
+ * Min/Max of BIGINT. The accumulator is first brought to the signedness the
+ * run needs by the scalar kernel, exactly one value does it.
+ */
+int32_t ExtremeIntRun(ExtremePartsFn pass, bool is_min, bool is_unsigned,
+                      const void* vals, const bool* is_null, uint32_t n,
+                      AggResItem* res) {
+  int32_t (*kernel)(const Register&, AggResItem*) = is_min ? Min : Max;
+  uint32_t begin = 0;
+  if (res->type != kTypeBigInt) {
+    return ScalarRun(kernel, vals, kTypeBigInt, is_unsigned, is_null, 0, n,
+                     res);
+  }
+  while (begin < n && res->is_unsigned != is_unsigned) {
+    if (!is_unsigned) {
+      // Signed values into an unsigned accumulator stay on the scalar path.
+      return ScalarRun(kernel, vals, kTypeBigInt, is_unsigned, is_null,
+                       begin, n, res);
+    }
+    if (ScalarRun(kernel, vals, kTypeBigInt, is_unsigned, is_null,
+                  begin, begin + 1, res) < 0) {
+      return -1;
+    }
+    begin++;
+  }
+
+  ExtremeParts parts;
+  memset(&parts, 0, sizeof(parts));
+  pass(static_cast<const DataValue*>(vals) + begin,
+       is_null ? is_null + begin : nullptr, n - begin, &parts);
+  if (!parts.any) {
+    return 0;
+  }
+  if (is_unsigned) {
+    uint64_t v = parts.value.val_uint64;
+    if (res->inited == false) {
+      res->value.val_uint64 = is_min ? ULLONG_MAX : 0;
+      res->inited = true;
+    }
+    if (is_min ? v < res->value.val_uint64 : v > res->value.val_uint64) {
+      res->value.val_uint64 = v;
+    }
+  } else {
+    int64_t v = parts.value.val_int64;
+    if (res->inited == false) {
+      res->value.val_int64 = is_min ? LLONG_MAX : LLONG_MIN;
+      res->inited = true;
+    }
+    if (is_min ? v < res->value.val_int64 : v > res->value.val_int64) {
+      res->value.val_int64 = v;
+    }
+  }
+  return 0;
+}
+
+int32_t ExtremeDoubleRun(ExtremePartsFn pass, bool is_min, const double* vals,
+                         const bool* is_null, uint32_t n, AggResItem* res) {
+  int32_t (*kernel)(const Register&, AggResItem*) = is_min ? Min : Max;
+  if (res->type != kTypeDouble) {
+    return ScalarRun(kernel, vals, kTypeDouble, false, is_null, 0, n, res);
+  }
+  ExtremeParts parts;
+  memset(&parts, 0, sizeof(parts));
+  pass(vals, is_null, n, &parts);
+  if (!parts.any) {
+    return 0;
+  }
+  if (parts.nan) {
+    // The order NaNs are met in matters, replay the run.
+    return ScalarRun(kernel, vals, kTypeDouble, false, is_null, 0, n, res);
+  }
+  double v = parts.value.val_double;
+  if (is_min ? v < res->value.val_double : v > res->value.val_double) {
+    res->value.val_double = v;
+  }
+  return 0;
+}
+
+int32_t MinInt64Run(const int64_t* vals, const bool* is_null, uint32_t n,
+                    AggResItem* res) {
+  return ExtremeIntRun(Kernels()->min_int64, true, false, vals, is_null, n,
+                       res);
+}
+
+int32_t MinUint64Run(const uint64_t* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res) {
+  return ExtremeIntRun(Kernels()->min_uint64, true, true, vals, is_null, n,
+                       res);
+}
+
+int32_t MinDoubleRun(const double* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res) {
+  return ExtremeDoubleRun(Kernels()->min_double, true, vals, is_null, n, res);
+}
+
+int32_t MaxInt64Run(const int64_t* vals, const bool* is_null, uint32_t n,
+                    AggResItem* res) {
+  return ExtremeIntRun(Kernels()->max_int64, false, false, vals, is_null, n,
+                       res);
+}
+
+int32_t MaxUint64Run(const uint64_t* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res) {
+  return ExtremeIntRun(Kernels()->max_uint64, false, true, vals, is_null, n,
+                       res);
+}
+
+int32_t MaxDoubleRun(const double* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res) {
+  return ExtremeDoubleRun(Kernels()->max_double, false, vals, is_null, n,
+                          res);
+}
+
+int32_t CountRun(const bool* is_null, uint32_t n, AggResItem* res) {
+  uint32_t n_nulls = 0;
+  if (is_null != nullptr) {
+    // A flag is a 0 or 1 byte, so a popcount counts 8 of them at once.
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      uint64_t word;
+      memcpy(&word, is_null + i, sizeof(word));
+      n_nulls += std::bitset<64>(word).count();
+    }
+    for (; i < n; i++) {
+      n_nulls += is_null[i];
+    }
+  }
+  if (n_nulls < n) {
+    res->value.val_uint64 += (n - n_nulls);
+    res->is_unsigned = true;
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef AGG_KERNELS_H_
+#define AGG_KERNELS_H_
+
+#include "interpreter.h"
+
+/*
+ * Per-row aggregation kernels, defined in interpreter.cc.
+ */
+int32_t Sum(const Register& a, AggResItem* res);
+int32_t Min(const Register& a, AggResItem* res);
+int32_t Max(const Register& a, AggResItem* res);
+int32_t Count(const Register& a, AggResItem* res);
+/*
+ * The arithmetic kernel of |op| checking the operand types per call, also
+ * defined in interpreter.cc.
+ */
+RegOpReg GetArithKernel(uint8_t op);
+
+enum SimdLevel {
+  kSimdScalar = 0,
+  kSimdAvx2,
+  kSimdAvx512
+};
+
+/*
+ * The best level the running CPU supports.
+ */
+SimdLevel DetectSimdLevel();
+/*
+ * The level the run kernels below dispatch to, DetectSimdLevel() by default.
+ * SetSimdLevel() can only lower it, e.g. to compare the implementations.
+ */
+SimdLevel GetSimdLevel();
+void SetSimdLevel(SimdLevel level);
+
+/*
+ * Aggregation kernels over a contiguous run of n values. |is_null| marks the
+ * NULL rows and may be nullptr if there is none. Each call leaves |res| as
+ * the same sequence of Sum()/Min()/Max()/Count() calls would, with the same
+ * overflow detection: on overflow -1 is returned and |res| is left as it was
+ * right before the overflowing value. The only difference is that the DOUBLE
+ * sum adds the values in a different order, so its last bits may differ.
+ */
+int32_t SumInt64Run(const int64_t* vals, const bool* is_null, uint32_t n,
+                    AggResItem* res);
+int32_t SumUint64Run(const uint64_t* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res);
+int32_t SumDoubleRun(const double* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res);
+
+int32_t MinInt64Run(const int64_t* vals, const bool* is_null, uint32_t n,
+                    AggResItem* res);
+int32_t MinUint64Run(const uint64_t* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res);
+int32_t MinDoubleRun(const double* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res);
+
+int32_t MaxInt64Run(const int64_t* vals, const bool* is_null, uint32_t n,
+                    AggResItem* res);
+int32_t MaxUint64Run(const uint64_t* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res);
+int32_t MaxDoubleRun(const double* vals, const bool* is_null, uint32_t n,
+                     AggResItem* res);
+
+int32_t CountRun(const bool* is_null, uint32_t n, AggResItem* res);
+
+#endif  // AGG_KERNELS_H_
@@ -0,0 +1,45 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include "arena.h"
+
+Arena::Arena(size_t block_size)
+  : block_size_(block_size), ptr_(nullptr), left_(0), blocks_(nullptr),
+    allocated_(0) {
+}
+
+Arena::~Arena() {
+  while (blocks_) {
+    Block* next = blocks_->next;
+    delete[] reinterpret_cast<char*>(blocks_);
+    blocks_ = next;
+  }
+}
+
+/*
+ * Returns a new block with room for |len| bytes after its header.
+ */
+char* Arena::NewBlock(size_t len) {
+  size_t header = (sizeof(Block) + kAlign - 1) & ~(kAlign - 1);
+  char* mem = new char[header + len];
+  Block* block = reinterpret_cast<Block*>(mem);
+  block->next = blocks_;
+  blocks_ = block;
+  allocated_ += header + len;
+  return mem + header;
+}
+
+char* Arena::AllocateSlow(size_t len) {
+  if (len > block_size_ / 4) {
+    // Big enough to get its own block, keep bumping in the current one.
+    return NewBlock(len);
+  }
+  ptr_ = NewBlock(block_size_);
+  left_ = block_size_;
+  char* res = ptr_;
+  ptr_ += len;
+  left_ -= len;
+  return res;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Bump-pointer allocator. Memory is carved out of large blocks and only
+ * given back, all at once, when the arena is destroyed.
+ */
+class Arena {
+ public:
+  static const size_t kDefaultBlockSize = 64 * 1024;
+  static const size_t kAlign = 8;
+
+  explicit Arena(size_t block_size = kDefaultBlockSize);
+  ~Arena();
+
+  /*
+   * Returns |len| bytes aligned to kAlign.
+   */
+  char* Allocate(size_t len) {
+    len = (len + kAlign - 1) & ~(kAlign - 1);
+    if (len > left_) {
+      return AllocateSlow(len);
+    }
+    char* res = ptr_;
+    ptr_ += len;
+    left_ -= len;
+    return res;
+  }
+
+  /*
+   * Bytes taken from the system so far.
+   */
+  size_t allocated() const {
+    return allocated_;
+  }
+
+ private:
+  struct Block {
+    Block* next;
+  };
+
+  char* AllocateSlow(size_t len);
+  char* NewBlock(size_t len);
+
+  size_t block_size_;
+  char* ptr_;
+  size_t left_;
+  Block* blocks_;
+  size_t allocated_;
+};
+
+#endif  // ARENA_H_
@@ -0,0 +1,397 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench_util.h"
+#include "interpreter.h"
+#include "parallel.h"
+#include "result_cursor.h"
+
+/*
+ * End to end benchmark: aggregates rows of Record::schema_ held in memory
+ * under every combination of the dimensions below, and prints one JSON
+ * object with a result per scenario to stdout, so runs can be diffed.
+ *
+ * -n <N>: rows, 1M by default.
+ * -p <shapes>: programs, comma separated, out of
+ *    main: the query of main.cc, eight aggs over arithmetic,
+ *    sum: SUM(a),
+ *    count: COUNT(a),
+ *    deep: SUM of a 32 operator deep expression over a, b, c and d.
+ *    All of them by default.
+ * -g <list>: group cardinalities, 10,10000,1000000 by default. Keys are
+ *    drawn uniformly.
+ * -k <list>: group by key types, bigint (column 4) and varchar (column 5,
+ *    the key in letters), both by default.
+ * -B <list>: rows per ProcessRows() call, 1024,65536 by default.
+ * -t <list>: threads, 1 through AggInterpreter, more through
+ *    ParallelAggregator. 1,4 by default.
+ * -r <N>: runs of each scenario, the fastest is reported. 3 by default.
+ * -s <seed>: seed of the rows, 1 by default.
+ *
+ * The time covers aggregating all rows and, on threads, merging the
+ * partial results, not building the interpreter. peak_rss_kb is the high
+ * water mark of the process during the scenario, the rows included. The
+ * build compiles bench with -O2, over the -O0 of the other targets, so the
+ * numbers are those of optimized code.
+ */
+
+namespace {
+
+const char* const kShapes[] = {"main", "sum", "count", "deep"};
+const uint32_t kNumShapes = sizeof(kShapes) / sizeof(kShapes[0]);
+const uint32_t kKeyCols[] = {4, 5};
+const char* const kKeyNames[] = {"bigint", "varchar"};
+// Letters of a VARCHAR key, enough for 26^8 groups.
+const uint32_t kKeyLetters = 8;
+// Rounds of ((x + d) * a - c) / d in the deep program.
+const uint32_t kDeepRounds = 8;
+
+struct Options {
+  uint64_t n_rows = 1000000;
+  std::vector<uint32_t> shapes = {0, 1, 2, 3};
+  std::vector<uint64_t> cardinalities = {10, 10000, 1000000};
+  std::vector<uint32_t> keys = {0, 1};
+  std::vector<uint64_t> batches = {1024, 65536};
+  std::vector<uint64_t> threads = {1, 4};
+  uint32_t runs = 3;
+  uint64_t seed = 1;
+};
+
+uint32_t LoadCol(ColumnType type, bool is_unsigned, uint32_t reg,
+                 uint32_t col) {
+  return static_cast<uint32_t>(kOpLoadCol) << 26 |
+         static_cast<uint32_t>(is_unsigned) << 25 | type << 21 |
+         (reg & 0x0F) << 16 | (col & 0xFFFF);
+}
+
+/*
+ * reg = reg op reg2, typed as the registers hold them.
+ */
+uint32_t Arith(InterpreterOp op, ColumnType type, bool is_unsigned,
+               ColumnType type2, bool is_unsigned2, uint32_t reg,
+               uint32_t reg2) {
+  return static_cast<uint32_t>(op) << 26 |
+         static_cast<uint32_t>(is_unsigned) << 25 | type << 21 |
+         static_cast<uint32_t>(is_unsigned2) << 20 | type2 << 16 |
+         (reg & 0x0F) << 12 | (reg2 & 0x0F) << 8;
+}
+
+uint32_t Agg(InterpreterOp op, ColumnType type, uint32_t reg,
+             uint32_t agg) {
+  return static_cast<uint32_t>(op) << 26 | type << 21 |
+         (reg & 0x0F) << 16 | (agg & 0xFFFF);
+}
+
+/*
+ * Fills |prog| with program |shape| grouped by column |key_col|.
+ */
+void BuildProgram(uint32_t shape, uint32_t key_col,
+                  std::vector<uint32_t>* prog) {
+  const ColumnType kB = kTypeBigInt;
+  const ColumnType kD = kTypeDouble;
+  std::vector<uint32_t> types;
+  std::vector<uint32_t> insts;
+  switch (shape) {
+    case 0:
+      // count(a), sum(a/b+c*d), max((a+b)*c/d), min(b%c-d), sum(a+c),
+      // count(d/c), sum(a/b), sum(c*d)
+      types = {kB, kD, kD, kD, kB, kB, kD, kD};
+      insts = {
+        LoadCol(kB, false, kReg1, 0), Agg(kOpCount, kB, kReg1, 0),
+        LoadCol(kB, false, kReg1, 0), LoadCol(kD, false, kReg2, 1),
+        Arith(kOpDiv, kB, false, kD, false, kReg1, kReg2),
+        LoadCol(kB, true, kReg2, 2), LoadCol(kD, false, kReg3, 3),
+        Arith(kOpMul, kB, true, kD, false, kReg2, kReg3),
+        Arith(kOpPlus, kD, false, kD, false, kReg1, kReg2),
+        Agg(kOpSum, kD, kReg1, 1),
+        LoadCol(kB, false, kReg1, 0), LoadCol(kD, false, kReg2, 1),
+        Arith(kOpPlus, kB, false, kD, false, kReg1, kReg2),
+        LoadCol(kB, true, kReg2, 2),
+        Arith(kOpMul, kD, false, kB, true, kReg1, kReg2),
+        LoadCol(kD, false, kReg2, 3),
+        Arith(kOpDiv, kD, false, kD, false, kReg1, kReg2),
+        Agg(kOpMax, kD, kReg1, 2),
+        LoadCol(kD, false, kReg1, 1), LoadCol(kB, true, kReg2, 2),
+        Arith(kOpMod, kD, false, kB, true, kReg1, kReg2),
+        LoadCol(kD, false, kReg2, 3),
+        Arith(kOpMinus, kD, false, kD, false, kReg1, kReg2),
+        Agg(kOpMin, kD, kReg1, 3),
+        LoadCol(kB, false, kReg1, 0), LoadCol(kB, true, kReg2, 2),
+        Arith(kOpPlus, kB, false, kB, true, kReg1, kReg2),
+        Agg(kOpSum, kB, kReg1, 4),
+        LoadCol(kD, false, kReg1, 3), LoadCol(kB, true, kReg2, 2),
+        Arith(kOpDiv, kD, false, kB, true, kReg1, kReg2),
+        Agg(kOpCount, kB, kReg1, 5),
+        LoadCol(kB, false, kReg1, 0), LoadCol(kD, false, kReg2, 1),
+        Arith(kOpDiv, kB, false, kD, false, kReg1, kReg2),
+        Agg(kOpSum, kD, kReg1, 6),
+        LoadCol(kB, true, kReg2, 2), LoadCol(kD, false, kReg3, 3),
+        Arith(kOpMul, kB, true, kD, false, kReg2, kReg3),
+        Agg(kOpSum, kD, kReg2, 7)
+      };
+      break;
+    case 1:
+      types = {kB};
+      insts = {LoadCol(kB, false, kReg1, 0), Agg(kOpSum, kB, kReg1, 0)};
+      break;
+    case 2:
+      types = {kB};
+      insts = {LoadCol(kB, false, kReg1, 0), Agg(kOpCount, kB, kReg1, 0)};
+      break;
+    default:
+      types = {kD};
+      insts = {LoadCol(kD, false, kReg1, 1), LoadCol(kD, false, kReg2, 3),
+               LoadCol(kB, false, kReg3, 0), LoadCol(kB, true, kReg4, 2)};
+      for (uint32_t i = 0; i < kDeepRounds; i++) {
+        insts.push_back(Arith(kOpPlus, kD, false, kD, false, kReg1, kReg2));
+        insts.push_back(Arith(kOpMul, kD, false, kB, false, kReg1, kReg3));
+        insts.push_back(Arith(kOpMinus, kD, false, kB, true, kReg1, kReg4));
+        insts.push_back(Arith(kOpDiv, kD, false, kD, false, kReg1, kReg2));
+      }
+      insts.push_back(Agg(kOpSum, kD, kReg1, 0));
+      break;
+  }
+  prog->clear();
+  prog->push_back(0);
+  prog->push_back(1 << 16 | types.size());
+  prog->push_back(key_col);
+  prog->insert(prog->end(), types.begin(), types.end());
+  prog->insert(prog->end(), insts.begin(), insts.end());
+  (*prog)[0] = 0x0721 << 16 | prog->size();
+}
+
+/*
+ * |n_rows| rows with keys uniform in [0, cardinality), both as column 4
+ * and in letters as column 5.
+ */
+void GenerateRows(uint64_t n_rows, uint64_t cardinality, uint64_t seed,
+                  unsigned char* rows) {
+  std::mt19937_64 gen(seed);
+  std::uniform_int_distribution<uint64_t> key_dist(0, cardinality - 1);
+  std::uniform_int_distribution<int64_t> int_dist(-1000, 1000);
+  std::uniform_real_distribution<double> double_dist(1, 1000);
+  char key[kKeyLetters + 1];
+  for (uint64_t r = 0; r < n_rows; r++) {
+    uint64_t k = key_dist(gen);
+    for (uint64_t i = 0, rest = k; i < kKeyLetters; i++, rest /= 26) {
+      key[kKeyLetters - 1 - i] = 'a' + rest % 26;
+    }
+    key[kKeyLetters] = '\0';
+    int64_t a = int_dist(gen);
+    double b = double_dist(gen);
+    // a + c stays a valid BIGINT UNSIGNED.
+    uint64_t c = int_dist(gen) + 2001;
+    double d = double_dist(gen);
+    Record::Encode(a, b, c, d, k, key, sizeof(key),
+                   rows + r * Record::encoded_length_);
+  }
+}
+
+/*
+ * Resets the high water mark of the resident set where Linux allows it,
+ * so a scenario doesn't report the peak of an earlier one.
+ */
+void ResetPeakRss() {
+  FILE* file = fopen("/proc/self/clear_refs", "w");
+  if (file) {
+    fputs("5", file);
+    fclose(file);
+  }
+}
+
+uint64_t PeakRssKb() {
+  FILE* file = fopen("/proc/self/status", "r");
+  if (file) {
+    char line[256];
+    unsigned long long kb;
+    while (fgets(line, sizeof(line), file)) {
+      if (sscanf(line, "VmHWM: %llu kB", &kb) == 1) {
+        fclose(file);
+        return kb;
+      }
+    }
+    fclose(file);
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+struct RunResult {
+  bool ok;
+  double secs;
+  uint64_t n_groups;
+};
+
+/*
+ * Aggregates all rows once and counts the groups.
+ */
+RunResult RunOnce(const std::vector<uint32_t>& prog,
+                  const unsigned char* rows, uint64_t n_rows,
+                  uint64_t batch, uint32_t n_threads) {
+  RunResult res = {false, 0, 0};
+  AggInterpreter agg(prog.data(), prog.size());
+  ParallelAggregator pagg(prog.data(), prog.size(), n_threads);
+  if (n_threads > 1 ? !pagg.Init() : !agg.Init()) {
+    return res;
+  }
+  AggInterpreter* out = &agg;
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  bool ok = true;
+  for (uint64_t r = 0; ok && r < n_rows; r += batch) {
+    uint32_t n = n_rows - r < batch ? n_rows - r : batch;
+    const unsigned char* p = rows + r * Record::encoded_length_;
+    ok = n_threads > 1 ? pagg.ProcessRows(p, n) : agg.ProcessRows(p, n);
+  }
+  if (ok && n_threads > 1) {
+    out = pagg.Finish();
+    ok = out != nullptr;
+  }
+  res.secs = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+  if (!ok) {
+    return res;
+  }
+  ResultCursor cursor(out);
+  const uint8_t* key;
+  uint32_t key_len;
+  const AggResItem* items;
+  while (cursor.Next(&key, &key_len, &items)) {
+    res.n_groups++;
+  }
+  res.ok = cursor.ok();
+  return res;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  bool ok = true;
+  int c;
+  while ((c = getopt(argc, argv, "n:p:g:k:B:t:r:s:")) != -1) {
+    switch (c) {
+      case 'n':
+        opt.n_rows = strtoull(optarg, nullptr, 10);
+        break;
+      case 'p':
+        ok = ParseNames(optarg, kShapes, kNumShapes, &opt.shapes);
+        break;
+      case 'g':
+        ok = ParseList(optarg, false, &opt.cardinalities);
+        break;
+      case 'k':
+        ok = ParseNames(optarg, kKeyNames, 2, &opt.keys);
+        break;
+      case 'B':
+        ok = ParseList(optarg, false, &opt.batches);
+        break;
+      case 't':
+        ok = ParseList(optarg, false, &opt.threads);
+        break;
+      case 'r':
+        opt.runs = strtoul(optarg, nullptr, 10);
+        break;
+      case 's':
+        opt.seed = strtoull(optarg, nullptr, 10);
+        break;
+      default:
+        ok = false;
+        break;
+    }
+    if (!ok) {
+      fprintf(stderr, "Usage: %s [-n rows] [-p shapes] [-g cardinalities] "
+              "[-k key_types] [-B batch_sizes] [-t threads] [-r runs] "
+              "[-s seed]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (opt.n_rows == 0 || opt.runs == 0) {
+    fprintf(stderr, "Need at least one row and one run\n");
+    return 1;
+  }
+  for (uint64_t batch : opt.batches) {
+    if (batch > UINT32_MAX) {
+      fprintf(stderr, "Batch size %llu too large\n",
+              static_cast<unsigned long long>(batch));
+      return 1;
+    }
+  }
+
+  unsigned char* rows =
+      new unsigned char[opt.n_rows * Record::encoded_length_];
+  std::vector<uint32_t> prog;
+  printf("{\n  \"rows\": %llu,\n  \"runs\": %u,\n  \"seed\": %llu,\n"
+         "  \"scenarios\": [",
+         static_cast<unsigned long long>(opt.n_rows), opt.runs,
+         static_cast<unsigned long long>(opt.seed));
+  bool first = true;
+  int ret = 0;
+  for (uint64_t cardinality : opt.cardinalities) {
+    GenerateRows(opt.n_rows, cardinality, opt.seed, rows);
+    for (uint32_t key : opt.keys) {
+      for (uint32_t shape : opt.shapes) {
+        BuildProgram(shape, kKeyCols[key], &prog);
+        for (uint64_t batch : opt.batches) {
+          for (uint64_t n_threads : opt.threads) {
+            ResetPeakRss();
+            RunResult best = {false, 0, 0};
+            for (uint32_t run = 0; run < opt.runs; run++) {
+              RunResult res = RunOnce(prog, rows, opt.n_rows, batch,
+                                      n_threads);
+              if (!res.ok) {
+                best = res;
+                break;
+              }
+              if (!best.ok || res.secs < best.secs) {
+                best = res;
+              }
+            }
+            uint64_t peak_rss = PeakRssKb();
+            if (!best.ok) {
+              fprintf(stderr, "Scenario %s/%llu/%s/%llu/%llu failed\n",
+                      kShapes[shape],
+                      static_cast<unsigned long long>(cardinality),
+                      kKeyNames[key], static_cast<unsigned long long>(batch),
+                      static_cast<unsigned long long>(n_threads));
+              ret = 1;
+              continue;
+            }
+            double secs = best.secs > 0 ? best.secs : 1e-9;
+            printf("%s\n    {\"shape\": \"%s\", \"cardinality\": %llu, "
+                   "\"key\": \"%s\", \"batch\": %llu, \"threads\": %llu, "
+                   "\"groups\": %llu, \"seconds\": %.6f, "
+                   "\"records_per_sec\": %.0f, \"ns_per_record\": %.2f, "
+                   "\"groups_per_sec\": %.0f, \"peak_rss_kb\": %llu}",
+                   first ? "" : ",", kShapes[shape],
+                   static_cast<unsigned long long>(cardinality),
+                   kKeyNames[key], static_cast<unsigned long long>(batch),
+                   static_cast<unsigned long long>(n_threads),
+                   static_cast<unsigned long long>(best.n_groups),
+                   best.secs, opt.n_rows / secs, secs * 1e9 / opt.n_rows,
+                   best.n_groups / secs,
+                   static_cast<unsigned long long>(peak_rss));
+            fflush(stdout);
+            first = false;
+          }
+        }
+      }
+    }
+  }
+  printf("\n  ]\n}\n");
+  delete[] rows;
+  return ret;
+}
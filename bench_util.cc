@@ -0,0 +1,59 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include "bench_util.h"
+
+#include <stdlib.h>
+#include <string>
+
+namespace {
+
+void SplitList(const char* arg, std::vector<std::string>* items) {
+  std::string list(arg);
+  size_t pos = 0;
+  while (pos <= list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    items->push_back(list.substr(pos, end - pos));
+    pos = end + 1;
+  }
+}
+
+}  // namespace
+
+bool ParseList(const char* arg, bool allow_zero, std::vector<uint64_t>* out) {
+  out->clear();
+  std::vector<std::string> items;
+  SplitList(arg, &items);
+  for (const std::string& item : items) {
+    char* stop = nullptr;
+    uint64_t value = strtoull(item.c_str(), &stop, 10);
+    if (item.empty() || *stop != '\0' || (value == 0 && !allow_zero)) {
+      return false;
+    }
+    out->push_back(value);
+  }
+  return true;
+}
+
+bool ParseNames(const char* arg, const char* const* names, uint32_t n_names,
+                std::vector<uint32_t>* out) {
+  out->clear();
+  std::vector<std::string> items;
+  SplitList(arg, &items);
+  for (const std::string& item : items) {
+    uint32_t i = 0;
+    while (i < n_names && item != names[i]) {
+      i++;
+    }
+    if (i == n_names) {
+      return false;
+    }
+    out->push_back(i);
+  }
+  return true;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Option parsing shared by bench and group_bench. Both take the dimensions
+ * they sweep as comma separated lists, and return false on an empty or
+ * unknown item.
+ */
+
+/*
+ * The numbers in |arg|, each above 0 unless |allow_zero|.
+ */
+bool ParseList(const char* arg, bool allow_zero, std::vector<uint64_t>* out);
+
+/*
+ * Indexes into |names| of the names in |arg|.
+ */
+bool ParseNames(const char* arg, const char* const* names, uint32_t n_names,
+                std::vector<uint32_t>* out);
+
+#endif  // BENCH_UTIL_H_
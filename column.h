@@ -21,12 +21,68 @@ enum ColumnType {
   kTypeVarchar
 };
 
+/*
+ * Type of a column in the records an aggregation program runs against.
+ */
+struct ColumnDef {
+  ColumnType type;
+  bool is_unsigned;
+  uint32_t length;  // VARCHAR only, the most bytes it holds with the NUL
+};
+
+/*
+ * Bytes a value of |def| takes in an encoded row: integers 1, 2, 3, 4 or 8
+ * by type, FLOAT 4, DOUBLE 8, and a VARCHAR its 4-byte length followed by
+ * room for |length| bytes.
+ */
+inline uint32_t EncodedWidth(const ColumnDef& def) {
+  switch (def.type) {
+    case kTypeTinyInt:
+      return 1;
+    case kTypeSmallInt:
+      return 2;
+    case kTypeMediumInt:
+      return 3;
+    case kTypeInt:
+    case kTypeFloat:
+      return 4;
+    case kTypeVarchar:
+      return sizeof(uint32_t) + def.length;
+    default:
+      return 8;
+  }
+}
+
+/*
+ * A column of a ColumnBatch. Numbers take EncodedWidth() bytes each in
+ * |data|, little endian. VARCHAR values go back to back in |data|, row r is
+ * [offsets[r], offsets[r + 1]), without the NUL the record ends them with,
+ * the same as ResultCursor::Export() gives group keys.
+ */
+struct ColumnVector {
+  const uint8_t* data;
+  const uint32_t* offsets;  // VARCHAR only, n_rows + 1 of them
+  // Bit r % 8 of byte r / 8 is set if row r isn't NULL, nullptr if none is.
+  // A NULL row still takes its bytes or its VARCHAR offsets.
+  const uint8_t* validity;
+};
+
+/*
+ * Rows stored column by column, a ColumnVector for each column of the
+ * schema.
+ */
+struct ColumnBatch {
+  uint32_t n_rows;
+  uint32_t n_cols;
+  const ColumnVector* cols;
+};
+
 class Column {
  public:
   explicit Column(unsigned char* buf, uint32_t raw_length,
                  uint32_t encoded_length)
     : buf_(buf), raw_length_(raw_length), encoded_length_(encoded_length),
-    type_(kTypeUnknown), is_unsigned_(false) {
+    type_(kTypeUnknown), is_unsigned_(false), is_null_(false) {
     }
 
   virtual ~Column() {}
@@ -52,12 +108,21 @@ class Column {
     return is_unsigned_;
   }
 
+  bool is_null() {
+    return is_null_;
+  }
+
+  void set_null() {
+    is_null_ = true;
+  }
+
  protected:
   unsigned char* buf_;
   uint32_t raw_length_;
   uint32_t encoded_length_;
   ColumnType type_;
   bool is_unsigned_;
+  bool is_null_;
 };
 
 class ColumnBigInt : public Column {
@@ -97,6 +162,47 @@ class ColumnDouble : public Column {
   }
 };
 
+/*
+ * TINYINT, SMALLINT, MEDIUMINT or INT, the low EncodedWidth() bytes of
+ * |value|, little endian.
+ */
+class ColumnInt : public Column {
+ public:
+  explicit ColumnInt(ColumnType type, int64_t value, unsigned char* buf,
+                     bool is_unsigned)
+    : Column(buf, EncodedWidth({type, is_unsigned, 0}),
+             EncodedWidth({type, is_unsigned, 0})) {
+      for (uint32_t i = 0; i < raw_length_; i++) {
+        buf_[i] = static_cast<unsigned char>(value >> (i * 8));
+      }
+      type_ = type;
+      is_unsigned_ = is_unsigned;
+    }
+
+  ~ColumnInt() override {
+  }
+
+  const unsigned char* data() override {
+    return buf_;
+  }
+};
+
+class ColumnFloat : public Column {
+ public:
+  explicit ColumnFloat(float value, unsigned char* buf)
+    : Column(buf, sizeof(value), sizeof(value)) {
+      memcpy(buf_, &value, sizeof(value));
+      type_ = kTypeFloat;
+    }
+
+  ~ColumnFloat() override {
+  }
+
+  const unsigned char* data() override {
+    return buf_;
+  }
+};
+
 class ColumnVarchar : public Column {
  public:
   explicit ColumnVarchar(const char* buffer, uint32_t buffer_len,
@@ -0,0 +1,347 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "csv_loader.h"
+
+namespace {
+
+// Bytes indexed at a time, a line must fit in it.
+const size_t kWindowSize = 256 << 10;
+// Field length strtod() and strtof() are given at most.
+const uint32_t kMaxSlowField = 64;
+
+/*
+ * Appends to |out| the offset from |base| of every ',' and '\n' in
+ * [begin, end), returns their number.
+ */
+uint32_t FindDelims(const char* base, const char* begin, const char* end,
+                    uint32_t* out) {
+  uint32_t n = 0;
+  const char* p = begin;
+#if defined(__SSE2__)
+  const __m128i comma = _mm_set1_epi8(',');
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; end - p >= 16; p += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    uint32_t mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(block, comma),
+                     _mm_cmpeq_epi8(block, newline)));
+    while (mask) {
+      out[n++] = p - base + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; p < end; p++) {
+    if (*p == ',' || *p == '\n') {
+      out[n++] = p - base;
+    }
+  }
+  return n;
+}
+
+bool ParseDigits(const char* p, const char* end, uint64_t* res) {
+  if (p == end) {
+    return false;
+  }
+  uint64_t value = 0;
+  for (; p < end; p++) {
+    uint32_t digit = static_cast<uint8_t>(*p) - '0';
+    if (digit > 9 || value > (UINT64_MAX - digit) / 10) {
+      return false;
+    }
+    value = value * 10 + digit;
+  }
+  *res = value;
+  return true;
+}
+
+bool ParseUInt(const char* p, const char* end, uint64_t* res) {
+  return ParseDigits(p + (p < end && *p == '+'), end, res);
+}
+
+bool ParseInt(const char* p, const char* end, int64_t* res) {
+  bool negative = p < end && *p == '-';
+  uint64_t magnitude;
+  if (!ParseDigits(p + (p < end && (*p == '-' || *p == '+')), end,
+                   &magnitude) ||
+      magnitude > static_cast<uint64_t>(INT64_MAX) + negative) {
+    return false;
+  }
+  *res = negative ? static_cast<int64_t>(0 - magnitude) :
+                    static_cast<int64_t>(magnitude);
+  return true;
+}
+
+/*
+ * strtod() or strtof() of the whole field, NUL terminated in a copy.
+ */
+bool ParseSlow(const char* p, const char* end, bool is_float, double* res) {
+  char buf[kMaxSlowField];
+  size_t len = end - p;
+  if (len == 0 || len >= sizeof(buf)) {
+    return false;
+  }
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+  char* stop = nullptr;
+  *res = is_float ? strtof(buf, &stop) : strtod(buf, &stop);
+  return stop == buf + len;
+}
+
+/*
+ * Exact decimal to double. Up to 19 significant digits are taken as an
+ * integer; when it and the power of ten are both exact doubles a single
+ * multiplication or division rounds correctly, anything else goes to
+ * strtod().
+ */
+bool ParseDouble(const char* p, const char* end, double* res) {
+  static const double kPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const char* s = p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = *s++ == '-';
+  }
+  uint64_t mantissa = 0;
+  int32_t n_digits = 0;
+  int32_t exp10 = 0;
+  bool any = false;
+  for (; s < end && static_cast<uint8_t>(*s - '0') <= 9; s++) {
+    any = true;
+    if (mantissa || *s != '0') {
+      if (++n_digits > 19) {
+        return ParseSlow(p, end, false, res);
+      }
+      mantissa = mantissa * 10 + (*s - '0');
+    }
+  }
+  if (s < end && *s == '.') {
+    for (s++; s < end && static_cast<uint8_t>(*s - '0') <= 9; s++) {
+      any = true;
+      exp10--;
+      if (mantissa || *s != '0') {
+        if (++n_digits > 19) {
+          return ParseSlow(p, end, false, res);
+        }
+        mantissa = mantissa * 10 + (*s - '0');
+      }
+    }
+  }
+  if (any && s < end && (*s == 'e' || *s == 'E')) {
+    int64_t exp;
+    if (!ParseInt(s + 1, end, &exp) || exp > 1000 || exp < -1000) {
+      return ParseSlow(p, end, false, res);
+    }
+    exp10 += exp;
+    s = end;
+  }
+  if (!any || s != end) {
+    // inf, nan or malformed.
+    return ParseSlow(p, end, false, res);
+  }
+  if (mantissa == 0) {
+    *res = negative ? -0.0 : 0.0;
+    return true;
+  }
+  if (mantissa > (1ULL << 53) || exp10 < -22 || exp10 > 22) {
+    return ParseSlow(p, end, false, res);
+  }
+  double value = static_cast<double>(mantissa);
+  value = exp10 < 0 ? value / kPow10[-exp10] : value * kPow10[exp10];
+  *res = negative ? -value : value;
+  return true;
+}
+
+/*
+ * Parses [p, end) as a value of |def| and writes it at |out| as a row
+ * encodes it.
+ */
+bool ParseField(const char* p, const char* end, const ColumnDef& def,
+                unsigned char* out) {
+  uint32_t width = EncodedWidth(def);
+  switch (def.type) {
+    case kTypeTinyInt:
+    case kTypeSmallInt:
+    case kTypeMediumInt:
+    case kTypeInt:
+    case kTypeBigInt: {
+      uint64_t bits;
+      if (def.is_unsigned) {
+        if (!ParseUInt(p, end, &bits) ||
+            (width < 8 && bits >> (width * 8) != 0)) {
+          return false;
+        }
+      } else {
+        int64_t value;
+        if (!ParseInt(p, end, &value)) {
+          return false;
+        }
+        int64_t max = width < 8 ? (1LL << (width * 8 - 1)) - 1 : INT64_MAX;
+        if (value > max || value < -max - 1) {
+          return false;
+        }
+        bits = static_cast<uint64_t>(value);
+      }
+      for (uint32_t i = 0; i < width; i++) {
+        out[i] = static_cast<unsigned char>(bits >> (i * 8));
+      }
+      return true;
+    }
+    case kTypeFloat: {
+      double value;
+      if (!ParseSlow(p, end, true, &value)) {
+        return false;
+      }
+      float f = static_cast<float>(value);
+      memcpy(out, &f, sizeof(f));
+      return true;
+    }
+    case kTypeDouble: {
+      double value;
+      if (!ParseDouble(p, end, &value)) {
+        return false;
+      }
+      memcpy(out, &value, sizeof(value));
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+CsvLoader::CsvLoader(const ColumnDef* schema, uint32_t n_cols,
+                     uint32_t n_fields, const unsigned char* defaults)
+  : layout_(schema, n_cols), n_fields_(n_fields), defaults_(defaults),
+    error_(false), fd_(-1), data_(nullptr), len_(0), line_(0), window_(0),
+    window_end_(0), delims_(new uint32_t[kWindowSize + 1]), n_delims_(0),
+    next_delim_(0) {
+  assert(n_fields > 0 && n_fields <= n_cols);
+  for (uint32_t i = 0; i < n_fields; i++) {
+    assert(schema[i].type != kTypeVarchar);
+  }
+}
+
+CsvLoader::~CsvLoader() {
+  if (data_) {
+    munmap(const_cast<char*>(data_), len_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  delete[] delims_;
+}
+
+bool CsvLoader::Open(const char* path) {
+  assert(fd_ < 0);
+  fd_ = open(path, O_RDONLY);
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st) != 0) {
+    return false;
+  }
+  len_ = st.st_size;
+  if (len_ == 0) {
+    return true;
+  }
+  void* data = mmap(nullptr, len_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (data == MAP_FAILED) {
+    len_ = 0;
+    return false;
+  }
+  madvise(data, len_, MADV_SEQUENTIAL);
+  data_ = static_cast<const char*>(data);
+  return true;
+}
+
+/*
+ * Indexes the delimiters of the window starting at the next line. The end
+ * of a file not ending with a newline counts as one.
+ */
+void CsvLoader::IndexWindow() {
+  window_ = line_;
+  window_end_ = len_ - window_ > kWindowSize ? window_ + kWindowSize : len_;
+  n_delims_ = FindDelims(data_ + window_, data_ + window_,
+                         data_ + window_end_, delims_);
+  if (window_end_ == len_ && data_[len_ - 1] != '\n') {
+    delims_[n_delims_++] = len_ - window_;
+  }
+  next_delim_ = 0;
+}
+
+/*
+ * Parses the line ending at delims[n_fields_ - 1] into |row|. An empty
+ * field is NULL.
+ */
+bool CsvLoader::ParseLine(const uint32_t* delims, unsigned char* row) {
+  memcpy(row, defaults_, layout_.length());
+  const char* field = data_ + line_;
+  for (uint32_t i = 0; i < n_fields_; i++) {
+    const char* end = data_ + window_ + delims[i];
+    if (end < data_ + len_ && *end != (i + 1 < n_fields_ ? ',' : '\n')) {
+      return false;
+    }
+    const char* value_end = end;
+    if (i + 1 == n_fields_ && value_end > field && value_end[-1] == '\r') {
+      value_end--;
+    }
+    if (value_end == field) {
+      layout_.SetNull(row, i);
+    } else if (!ParseField(field, value_end, layout_.def(i),
+                           row + layout_.offset(i))) {
+      return false;
+    }
+    field = end + 1;
+  }
+  return true;
+}
+
+uint32_t CsvLoader::Next(unsigned char* rows, uint32_t n) {
+  uint32_t n_rows = 0;
+  while (n_rows < n && !error_ && line_ < len_) {
+    if (next_delim_ + n_fields_ > n_delims_ && window_end_ < len_) {
+      IndexWindow();
+      if (next_delim_ + n_fields_ > n_delims_ && window_end_ < len_) {
+        // Longer than a window.
+        error_ = true;
+        break;
+      }
+    }
+    if (data_[line_] == '\n') {
+      line_++;
+      next_delim_++;
+      continue;
+    }
+    const uint32_t* delims = delims_ + next_delim_;
+    if (next_delim_ + n_fields_ > n_delims_ ||
+        !ParseLine(delims, rows + static_cast<size_t>(n_rows) *
+                           layout_.length())) {
+      error_ = true;
+      break;
+    }
+    next_delim_ += n_fields_;
+    // Past the newline, or at the end for the last line without one.
+    line_ = window_ + delims[n_fields_ - 1] + 1;
+    if (line_ > len_) {
+      line_ = len_;
+    }
+    n_rows++;
+  }
+  return n_rows;
+}
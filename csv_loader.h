@@ -0,0 +1,74 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef CSV_LOADER_H_
+#define CSV_LOADER_H_
+
+#include <stddef.h>
+
+#include "record.h"
+
+/*
+ * Loads a CSV file of numbers, a row per line, into rows encoded as
+ * AggInterpreter::ProcessRows() takes them. The file is mapped and parsed
+ * where it is: the delimiters of a window of it are found 16 bytes at a
+ * time with SSE2, then each field is converted in place, so nothing is
+ * copied or allocated per field. Doubles are parsed exactly, through
+ * strtod() only when the digits don't allow an exact fast conversion.
+ *
+ * Field i of a line goes to column i of the schema, which must be numeric.
+ * Columns past the last field keep the values of |defaults|, a row of the
+ * schema copied into each row first.
+ */
+class CsvLoader {
+ public:
+  CsvLoader(const ColumnDef* schema, uint32_t n_cols, uint32_t n_fields,
+            const unsigned char* defaults);
+  ~CsvLoader();
+
+  /*
+   * Maps file |path|, false if it can't be read.
+   */
+  bool Open(const char* path);
+  /*
+   * Parses up to the next |n| lines into |rows|, packed row_length() bytes
+   * each. Returns how many, 0 at the end or at a malformed line, after
+   * which error() is true. Empty lines are skipped.
+   */
+  uint32_t Next(unsigned char* rows, uint32_t n);
+  bool error() const {
+    return error_;
+  }
+  uint32_t row_length() const {
+    return layout_.length();
+  }
+  // Bytes of the file parsed so far.
+  size_t bytes_parsed() const {
+    return line_;
+  }
+
+ private:
+  void IndexWindow();
+  bool ParseLine(const uint32_t* delims, unsigned char* row);
+
+  RowLayout layout_;
+  uint32_t n_fields_;
+  const unsigned char* defaults_;
+  bool error_;
+
+  int fd_;
+  const char* data_;
+  size_t len_;
+  size_t line_;  // where the next line starts
+
+  // Delimiters found in [window_, window_end_), as offsets from window_.
+  size_t window_;
+  size_t window_end_;
+  uint32_t* delims_;
+  uint32_t n_delims_;
+  uint32_t next_delim_;
+};
+
+#endif  // CSV_LOADER_H_
@@ -1,53 +1,488 @@
-#include <iostream>
-#include <fstream>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <functional>
 #include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
-int main() {
-  std::fstream fs;
-  std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_int_distribution<int64_t> distr_int64(-100000, 100000);
-	std::uniform_int_distribution<uint64_t> distr_uint64(100000, 200000);
-  std::uniform_real_distribution<double> distr_d1(-200000.0, 2000000.0);
-  std::uniform_real_distribution<double> distr_d2(0.0, 5000000);
-	std::uniform_int_distribution<int64_t> distr_int64_g(-2, 2);
-	std::uniform_int_distribution<int64_t> distr_zero(1, 10);
-
-  fs.open("data.txt", std::fstream::in | std::fstream::app);
-  int64_t v1;
-  double v2;
-  uint64_t v3;
-  double v4;
-  int64_t v5;
-
-	for (int i = 0; i < 1000000; i++) {
-    v1 = distr_int64(gen);
-    if (distr_zero(gen) == 6) {
-      v2 = 0.0;
-    } else {
-      v2 = distr_d1(gen);
-    }
-    if (distr_zero(gen) == 6) {
-      v3 = 0;
-      if (v1 < 0) {
-        v1 = 0 - v1;
+#include "table_file.h"
+
+/*
+ * Generates a table for the example and the benchmarks, as CSV text or,
+ * with -b, a table file, see table_file.h.
+ *
+ * -n <N>: rows, 1M by default.
+ * -c <types>: the columns, comma separated, out of tinyint, smallint,
+ *    mediumint, int, bigint, their unsigned forms prefixed by u (ubigint),
+ *    float, double and varchar. bigint,double,ubigint,double,bigint by
+ *    default, the numbers of data.txt, and with -b Record::schema_, the
+ *    same followed by a VARCHAR, so the example reads the table.
+ * -k <col>: the group by column, 4 by default. Its values are keys in
+ *    [0, cardinality), centered on 0 for signed integers.
+ * -g <N>: group cardinality, 1 to 1e8, 5 by default.
+ * -z <s>: Zipfian skew of the keys, key k taking a share of the rows
+ *    proportional to 1 / (k + 1)^s. 0, uniform, by default.
+ * -u <rate>: NULL rate of the columns other than the group by one, 0 by
+ *    default. A NULL is an empty field in the text.
+ * -0 <rate>: zero rate of the numbers other than column 0 and the group by
+ *    column, 0.1 by default as in data.txt. Without -c, the columns follow
+ *    data.txt further: a zero in column 2 makes a negative column 0
+ *    positive, and column 3 is in [0, 5e6).
+ * -l <N>: length of VARCHAR values, 10 by default. A VARCHAR key is its
+ *    number in letters, padded to that length.
+ * -s <seed>: 1 by default. The same seed gives the same rows whatever the
+ *    number of threads.
+ * -t <N>: generating threads, one per core by default.
+ * -b: write a table file instead of text.
+ * -o <path>: data.txt, or data.tbl with -b, by default.
+ */
+
+namespace {
+
+// Rows generated from one seeded stream, and written at once.
+const uint32_t kBlockRows = 64 * 1024;
+const uint64_t kMaxCardinality = 100000000;
+
+struct Options {
+  uint64_t n_rows = 1000000;
+  std::vector<ColumnDef> schema;
+  bool default_schema = true;
+  uint32_t key_col = 4;
+  uint64_t cardinality = 5;
+  double skew = 0;
+  double null_rate = 0;
+  double zero_rate = 0.1;
+  uint32_t str_len = 10;
+  uint64_t seed = 1;
+  uint32_t n_threads = 0;
+  bool binary = false;
+  const char* path = nullptr;
+};
+
+/*
+ * Draws ranks in [1, n] with P(k) proportional to 1 / k^s, in constant
+ * time whatever n, by rejection-inversion (Hormann and Derflinger, 1996).
+ */
+class ZipfSampler {
+ public:
+  ZipfSampler(uint64_t n, double s)
+    : n_(n), s_(s),
+      h_integral_x1_(HIntegral(1.5) - 1),
+      h_integral_n_(HIntegral(n + 0.5)),
+      s_threshold_(2 - HIntegralInverse(HIntegral(2.5) - H(2))) {
+  }
+
+  uint64_t Sample(std::mt19937_64* gen) const {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    while (true) {
+      double u = h_integral_n_ +
+                 uniform(*gen) * (h_integral_x1_ - h_integral_n_);
+      double x = HIntegralInverse(u);
+      double k = floor(x + 0.5);
+      if (k < 1) {
+        k = 1;
+      } else if (k > n_) {
+        k = n_;
       }
-    } else {
-      v3 = distr_uint64(gen);
-    }
-    if (distr_zero(gen) == 6) {
-      v4 = 0.0;
-    } else {
-      v4 = distr_d2(gen);
-    }
-    v5 = distr_int64_g(gen);
-    std::string str = std::to_string(v1) + "," + std::to_string(v2) + "," +
-                      std::to_string(v3) + "," + std::to_string(v4) + "," +
-                      std::to_string(v5);
-    fs << str;
-    fs << std::endl;
-	}
-  fs.close();
+      if (k - x <= s_threshold_ || u >= HIntegral(k + 0.5) - H(k)) {
+        return static_cast<uint64_t>(k);
+      }
+    }
+  }
+
+ private:
+  // log1p(x) / x and expm1(x) / x, both 1 at 0.
+  static double Helper1(double x) {
+    return fabs(x) > 1e-8 ? log1p(x) / x :
+           1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+  }
+  static double Helper2(double x) {
+    return fabs(x) > 1e-8 ? expm1(x) / x :
+           1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+  }
+  double H(double x) const {
+    return exp(-s_ * log(x));
+  }
+  double HIntegral(double x) const {
+    double log_x = log(x);
+    return Helper2((1 - s_) * log_x) * log_x;
+  }
+  double HIntegralInverse(double x) const {
+    double t = x * (1 - s_);
+    if (t < -1) {
+      t = -1;
+    }
+    return exp(Helper1(t) * x);
+  }
+
+  double n_;
+  double s_;
+  double h_integral_x1_;
+  double h_integral_n_;
+  double s_threshold_;
+};
 
+bool ParseType(const std::string& name, ColumnDef* def) {
+  static const struct {
+    const char* name;
+    ColumnType type;
+  } kTypes[] = {
+    {"tinyint", kTypeTinyInt}, {"smallint", kTypeSmallInt},
+    {"mediumint", kTypeMediumInt}, {"int", kTypeInt},
+    {"bigint", kTypeBigInt}, {"float", kTypeFloat},
+    {"double", kTypeDouble}, {"varchar", kTypeVarchar}
+  };
+  bool is_unsigned = name.size() > 1 && name[0] == 'u';
+  std::string base = is_unsigned ? name.substr(1) : name;
+  for (const auto& t : kTypes) {
+    if (base == t.name) {
+      if (is_unsigned && t.type > kTypeBigInt) {
+        return false;
+      }
+      *def = {t.type, is_unsigned, 0};
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ParseSchema(const char* spec, std::vector<ColumnDef>* schema) {
+  schema->clear();
+  std::string rest(spec);
+  size_t pos = 0;
+  while (true) {
+    size_t comma = rest.find(',', pos);
+    ColumnDef def;
+    if (!ParseType(rest.substr(pos, comma - pos), &def)) {
+      return false;
+    }
+    schema->push_back(def);
+    if (comma == std::string::npos) {
+      return true;
+    }
+    pos = comma + 1;
+  }
+}
+
+/*
+ * Writes key |key| as letters, the last one lowest, padded with 'a' to
+ * |len|.
+ */
+void KeyString(uint64_t key, uint32_t len, char* buf) {
+  for (uint32_t i = len; i > 0; i--) {
+    buf[i - 1] = 'a' + key % 26;
+    key /= 26;
+  }
+}
+
+/*
+ * Generates the |n| rows of block |block| from a stream seeded by it, as
+ * text into |text| or, if |rows| is given, encoded rows into it.
+ */
+void GenerateBlock(const Options& opt, const RowLayout& layout,
+                   const ZipfSampler* zipf, uint64_t block, uint32_t n,
+                   std::string* text, unsigned char* rows) {
+  std::seed_seq seq{static_cast<uint32_t>(opt.seed),
+                    static_cast<uint32_t>(opt.seed >> 32),
+                    static_cast<uint32_t>(block),
+                    static_cast<uint32_t>(block >> 32)};
+  std::mt19937_64 gen(seq);
+  std::uniform_real_distribution<double> unit(0, 1);
+  std::uniform_int_distribution<uint64_t> any_key(0, opt.cardinality - 1);
+  std::uniform_real_distribution<double> real(-200000.0, 2000000.0);
+  std::uniform_real_distribution<double> real3(0.0, 5000000.0);
+  std::uniform_int_distribution<int64_t> bigint(-100000, 100000);
+  std::uniform_int_distribution<uint64_t> ubigint(100000, 200000);
+  const uint32_t n_cols = opt.schema.size();
+  char field[64];
+
+  text->clear();
+  for (uint32_t r = 0; r < n; r++) {
+    unsigned char* row = rows ? rows + static_cast<size_t>(r) *
+                                layout.length() : nullptr;
+    if (row) {
+      layout.Clear(row);
+    }
+    // Drawn ahead, column 0 of data.txt depends on whether column 2 is zero.
+    uint64_t zeros = 0;
+    for (uint32_t c = 1; c < n_cols && opt.zero_rate > 0; c++) {
+      if (c != opt.key_col && opt.schema[c].type != kTypeVarchar &&
+          unit(gen) < opt.zero_rate) {
+        zeros |= 1ULL << c;
+      }
+    }
+    for (uint32_t c = 0; c < n_cols; c++) {
+      const ColumnDef& def = opt.schema[c];
+      const uint32_t width = EncodedWidth(def);
+      bool is_key = c == opt.key_col;
+      uint64_t key = 0;
+      if (is_key) {
+        key = zipf ? zipf->Sample(&gen) - 1 : any_key(gen);
+      } else if (opt.null_rate > 0 && unit(gen) < opt.null_rate) {
+        if (row) {
+          layout.SetNull(row, c);
+        } else if (c + 1 < n_cols) {
+          text->push_back(',');
+        }
+        continue;
+      }
+
+      int len = 0;
+      unsigned char* out = row ? row + layout.offset(c) : nullptr;
+      switch (def.type) {
+        case kTypeFloat:
+        case kTypeDouble: {
+          // Column 3 of data.txt is never negative.
+          double value = is_key ? static_cast<double>(key) :
+                         (zeros >> c) & 1 ? 0 :
+                         opt.default_schema && c == 3 ? real3(gen) :
+                         real(gen);
+          if (out && def.type == kTypeFloat) {
+            float f = static_cast<float>(value);
+            memcpy(out, &f, sizeof(f));
+          } else if (out) {
+            memcpy(out, &value, sizeof(value));
+          } else {
+            len = snprintf(field, sizeof(field), "%f", value);
+          }
+          break;
+        }
+        case kTypeVarchar:
+          if (is_key) {
+            KeyString(key, opt.str_len, field);
+          } else {
+            for (uint32_t i = 0; i < opt.str_len; i++) {
+              field[i] = 'a' + gen() % 26;
+            }
+          }
+          if (out) {
+            uint32_t raw_len = opt.str_len + 1;
+            memcpy(out, &raw_len, sizeof(raw_len));
+            memcpy(out + sizeof(raw_len), field, opt.str_len);
+          } else {
+            len = opt.str_len;
+          }
+          break;
+        default: {
+          // Integers: the default columns keep the ranges data.txt had,
+          // narrower ones span their whole type.
+          uint64_t bits;
+          if (is_key) {
+            bits = def.is_unsigned ? key : key - opt.cardinality / 2;
+          } else if ((zeros >> c) & 1) {
+            bits = 0;
+          } else if (width == 8) {
+            bits = def.is_unsigned ? ubigint(gen) :
+                                     static_cast<uint64_t>(bigint(gen));
+          } else {
+            bits = gen();
+          }
+          if (opt.default_schema && c == 0 && !is_key && (zeros >> 2) & 1 &&
+              static_cast<int64_t>(bits) < 0) {
+            bits = 0 - bits;
+          }
+          if (width < 8) {
+            // Sign extend the low bytes.
+            uint32_t shift = 64 - width * 8;
+            bits = def.is_unsigned ? bits << shift >> shift :
+                   static_cast<uint64_t>(
+                       static_cast<int64_t>(bits << shift) >> shift);
+          }
+          if (out) {
+            for (uint32_t i = 0; i < width; i++) {
+              out[i] = static_cast<unsigned char>(bits >> (i * 8));
+            }
+          } else if (def.is_unsigned) {
+            len = snprintf(field, sizeof(field), "%llu",
+                           static_cast<unsigned long long>(bits));
+          } else {
+            len = snprintf(field, sizeof(field), "%lld",
+                           static_cast<long long>(bits));
+          }
+          break;
+        }
+      }
+      if (row == nullptr) {
+        text->append(field, len);
+        if (c + 1 < n_cols) {
+          text->push_back(',');
+        }
+      }
+    }
+    if (row == nullptr) {
+      text->push_back('\n');
+    }
+  }
+}
+
+bool Validate(Options* opt) {
+  if (opt->binary && opt->default_schema) {
+    opt->schema.assign(Record::schema_, Record::schema_ + Record::n_cols);
+  }
+  if (opt->schema.empty() || opt->schema.size() > RowLayout::kMaxCols) {
+    fprintf(stderr, "1 to %u columns\n", RowLayout::kMaxCols);
+    return false;
+  }
+  if (opt->key_col >= opt->schema.size()) {
+    fprintf(stderr, "No column %u\n", opt->key_col);
+    return false;
+  }
+  if (opt->cardinality < 1 || opt->cardinality > kMaxCardinality) {
+    fprintf(stderr, "Cardinality from 1 to %llu\n",
+            static_cast<unsigned long long>(kMaxCardinality));
+    return false;
+  }
+  const ColumnDef& key = opt->schema[opt->key_col];
+  uint32_t width = EncodedWidth(key);
+  if (key.type != kTypeVarchar && key.type != kTypeFloat &&
+      key.type != kTypeDouble && width < 8 &&
+      opt->cardinality > (1ULL << (width * 8))) {
+    fprintf(stderr, "Cardinality too high for the key type\n");
+    return false;
+  }
+  double letters = opt->str_len * log(26.0);
+  if (key.type == kTypeVarchar && letters < log(opt->cardinality)) {
+    fprintf(stderr, "Keys too short for the cardinality\n");
+    return false;
+  }
+  if (opt->skew < 0 || opt->null_rate < 0 || opt->null_rate > 1 ||
+      opt->zero_rate < 0 || opt->zero_rate > 1 ||
+      opt->str_len == 0 || opt->str_len > 60) {
+    fprintf(stderr, "Bad skew, NULL rate, zero rate or string length\n");
+    return false;
+  }
+  for (ColumnDef& def : opt->schema) {
+    if (def.type == kTypeVarchar && def.length < opt->str_len + 1) {
+      def.length = opt->str_len + 1;
+    }
+  }
+  if (opt->n_threads == 0) {
+    opt->n_threads = std::thread::hardware_concurrency();
+    if (opt->n_threads == 0) {
+      opt->n_threads = 1;
+    }
+  }
+  if (opt->path == nullptr) {
+    opt->path = opt->binary ? "data.tbl" : "data.txt";
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  ParseSchema("bigint,double,ubigint,double,bigint", &opt.schema);
+  int c;
+  while ((c = getopt(argc, argv, "n:c:k:g:z:u:0:l:s:t:bo:")) != -1) {
+    switch (c) {
+      case 'n':
+        opt.n_rows = strtoull(optarg, nullptr, 10);
+        break;
+      case 'c':
+        if (!ParseSchema(optarg, &opt.schema)) {
+          fprintf(stderr, "Bad column types %s\n", optarg);
+          return 1;
+        }
+        opt.default_schema = false;
+        break;
+      case 'k':
+        opt.key_col = strtoul(optarg, nullptr, 10);
+        break;
+      case 'g':
+        opt.cardinality = strtod(optarg, nullptr);
+        break;
+      case 'z':
+        opt.skew = strtod(optarg, nullptr);
+        break;
+      case 'u':
+        opt.null_rate = strtod(optarg, nullptr);
+        break;
+      case '0':
+        opt.zero_rate = strtod(optarg, nullptr);
+        break;
+      case 'l':
+        opt.str_len = strtoul(optarg, nullptr, 10);
+        break;
+      case 's':
+        opt.seed = strtoull(optarg, nullptr, 10);
+        break;
+      case 't':
+        opt.n_threads = strtoul(optarg, nullptr, 10);
+        break;
+      case 'b':
+        opt.binary = true;
+        break;
+      case 'o':
+        opt.path = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n rows] [-c types] [-k key_col] "
+                "[-g cardinality] [-z skew] [-u null_rate] [-0 zero_rate] "
+                "[-l str_len] [-s seed] [-t threads] [-b] [-o path]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if (!Validate(&opt)) {
+    return 1;
+  }
+
+  RowLayout layout(opt.schema.data(), opt.schema.size());
+  ZipfSampler* zipf = opt.skew > 0 ?
+                      new ZipfSampler(opt.cardinality, opt.skew) : nullptr;
+  TableWriter writer(opt.schema.data(), opt.schema.size());
+  FILE* text_file = nullptr;
+  bool ok = opt.binary ? writer.Open(opt.path) :
+            (text_file = fopen(opt.path, "w")) != nullptr;
+
+  // Each round generates a block per thread, then writes them in order.
+  std::vector<std::string> texts(opt.n_threads);
+  std::vector<unsigned char*> rows(opt.n_threads, nullptr);
+  if (opt.binary) {
+    for (uint32_t t = 0; t < opt.n_threads; t++) {
+      rows[t] = new unsigned char[static_cast<size_t>(kBlockRows) *
+                                  layout.length()];
+    }
+  }
+  uint64_t n_blocks = (opt.n_rows + kBlockRows - 1) / kBlockRows;
+  for (uint64_t round = 0; ok && round < n_blocks; round += opt.n_threads) {
+    std::vector<std::thread> threads;
+    std::vector<uint32_t> sizes;
+    for (uint64_t b = round; b < n_blocks && b < round + opt.n_threads;
+         b++) {
+      uint64_t left = opt.n_rows - b * kBlockRows;
+      uint32_t n = left < kBlockRows ? left : kBlockRows;
+      uint32_t t = b - round;
+      sizes.push_back(n);
+      threads.emplace_back(GenerateBlock, std::cref(opt), std::cref(layout),
+                           zipf, b, n, &texts[t], rows[t]);
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    for (uint32_t t = 0; ok && t < sizes.size(); t++) {
+      ok = opt.binary ? writer.Append(rows[t], sizes[t]) :
+           fwrite(texts[t].data(), 1, texts[t].size(), text_file) ==
+               texts[t].size();
+    }
+  }
+  if (opt.binary) {
+    ok = writer.Close() && ok;
+  } else if (text_file) {
+    ok = fclose(text_file) == 0 && ok;
+  }
+  for (unsigned char* buf : rows) {
+    delete[] buf;
+  }
+  delete zipf;
+  if (!ok) {
+    fprintf(stderr, "Failed to write %s\n", opt.path);
+    return 1;
+  }
   return 0;
 }
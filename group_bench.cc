@@ -0,0 +1,442 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bench_util.h"
+#include "group_table.h"
+
+/*
+ * Micro benchmark of the group lookup layer alone: the tables below,
+ * behind one interface, are filled with distinct GROUP BY keys as the
+ * interpreter encodes them and then probed, and one JSON object with a
+ * result per scenario is printed to stdout.
+ *
+ * -n <list>: groups, 1000,100000,1000000 by default.
+ * -k <list>: key types, out of
+ *    bigint: 9 bytes, an integer group by column,
+ *    composite: 18 bytes, two of them,
+ *    varchar: 13 bytes, a VARCHAR of 7 letters as ColumnVarchar encodes it,
+ *    sparse: 9 bytes, integers kDensePageSize apart, a dense page each.
+ *    Each column has its kKeyNotNull byte in front.
+ *    All of them by default.
+ * -h <list>: hit ratios of the probes in percent, 0,25,50,75,100 by
+ *    default.
+ * -i <list>: tables, out of
+ *    group_table: GroupTable,
+ *    group_table_dense: GroupTable with its dense index, integer keys only,
+ *    std_map: std::map ordered by EntryCmp, as gb_map_ used to be,
+ *    std_unordered_map: std::unordered_map on HashGroupKey().
+ *    All of them by default.
+ * -q <N>: probes per hit ratio, 1M by default.
+ * -p <N>: bytes of state per group, 8 agg results by default.
+ * -r <N>: runs of each measurement, the fastest is reported. 3 by default.
+ * -s <seed>: 1 by default.
+ *
+ * Keys are ids, n of them inserted in random order and n others left out
+ * for the misses. insert_ns is the time of a FindOrInsert() adding a
+ * group, probe_ns that of a Find(). bytes_per_group is memory_usage() over
+ * the groups; the std tables count what their allocator handed out plus
+ * the arena holding keys and states, not the malloc overhead. As bench,
+ * it's built with -O2 whatever the other targets use.
+ */
+
+namespace {
+
+enum KeyType {
+  kKeyBigInt = 0,
+  kKeyComposite,
+  kKeyVarchar,
+  kKeySparse
+};
+const char* const kKeyNames[] = {"bigint", "composite", "varchar", "sparse"};
+const uint32_t kNumKeys = sizeof(kKeyNames) / sizeof(kKeyNames[0]);
+const uint32_t kKeyWidths[] = {9, 18, 13, 9};
+// Letters of a VARCHAR key, the NUL makes 8 bytes, the length 4 and the
+// flag 1 more.
+const uint32_t kKeyLetters = 7;
+
+enum IndexType {
+  kIndexGroupTable = 0,
+  kIndexGroupTableDense,
+  kIndexStdMap,
+  kIndexStdUnorderedMap
+};
+const char* const kIndexNames[] = {
+  "group_table", "group_table_dense", "std_map", "std_unordered_map"
+};
+const uint32_t kNumIndexes = sizeof(kIndexNames) / sizeof(kIndexNames[0]);
+
+struct Options {
+  std::vector<uint64_t> n_groups = {1000, 100000, 1000000};
+  std::vector<uint32_t> keys = {0, 1, 2, 3};
+  std::vector<uint64_t> hit_ratios = {0, 25, 50, 75, 100};
+  std::vector<uint32_t> indexes = {0, 1, 2, 3};
+  uint64_t n_probes = 1000000;
+  uint32_t payload_len = 8 * sizeof(AggResItem);
+  uint32_t runs = 3;
+  uint64_t seed = 1;
+};
+
+/*
+ * A table from a group key to the state of its group, as the interpreter
+ * needs it.
+ */
+class GroupIndex {
+ public:
+  virtual ~GroupIndex() {}
+  virtual char* FindOrInsert(const char* key, uint32_t len,
+                             bool* inserted) = 0;
+  virtual char* Find(const char* key, uint32_t len) const = 0;
+  virtual size_t memory_usage() const = 0;
+};
+
+class GroupTableIndex : public GroupIndex {
+ public:
+  GroupTableIndex(uint32_t payload_len, bool dense) : table_(payload_len) {
+    if (dense) {
+      table_.EnableDenseIndex(false);
+    }
+  }
+  char* FindOrInsert(const char* key, uint32_t len, bool* inserted) override {
+    return table_.FindOrInsert(key, len, inserted);
+  }
+  char* Find(const char* key, uint32_t len) const override {
+    return table_.Find(key, len);
+  }
+  size_t memory_usage() const override {
+    return table_.memory_usage();
+  }
+
+ private:
+  GroupTable table_;
+};
+
+/*
+ * Counts the bytes a std container holds through it.
+ */
+template <typename T>
+class CountingAllocator {
+ public:
+  typedef T value_type;
+
+  explicit CountingAllocator(size_t* bytes) : bytes_(bytes) {}
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U>& other)
+    : bytes_(other.bytes()) {}
+
+  T* allocate(size_t n) {
+    *bytes_ += n * sizeof(T);
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) {
+    *bytes_ -= n * sizeof(T);
+    ::operator delete(p);
+  }
+  size_t* bytes() const {
+    return bytes_;
+  }
+  template <typename U>
+  bool operator==(const CountingAllocator<U>& other) const {
+    return bytes_ == other.bytes();
+  }
+  template <typename U>
+  bool operator!=(const CountingAllocator<U>& other) const {
+    return bytes_ != other.bytes();
+  }
+
+ private:
+  size_t* bytes_;
+};
+
+struct EntryHash {
+  size_t operator()(const Entry& e) const {
+    return HashGroupKey(e.ptr, e.len);
+  }
+};
+
+struct EntryEq {
+  bool operator()(const Entry& a, const Entry& b) const {
+    return a.len == b.len && memcmp(a.ptr, b.ptr, a.len) == 0;
+  }
+};
+
+/*
+ * A std container of Entry to state. The key and state of a group are
+ * copied into an arena once, as GroupTable does, so only the container
+ * differs.
+ */
+template <typename Map>
+class StdIndex : public GroupIndex {
+ public:
+  StdIndex(uint32_t payload_len, Map* map, size_t* map_bytes)
+    : payload_len_(payload_len), map_(map), map_bytes_(map_bytes) {}
+  ~StdIndex() override {
+    delete map_;
+    delete map_bytes_;
+  }
+  char* FindOrInsert(const char* key, uint32_t len, bool* inserted) override {
+    Entry probe = {const_cast<char*>(key), len};
+    typename Map::iterator it = map_->find(probe);
+    if (it != map_->end()) {
+      *inserted = false;
+      return it->second;
+    }
+    uint32_t key_len = (len + Arena::kAlign - 1) & ~(Arena::kAlign - 1);
+    char* group = arena_.Allocate(key_len + payload_len_);
+    memcpy(group, key, len);
+    memset(group + key_len, 0, payload_len_);
+    map_->insert(std::make_pair(Entry{group, len}, group + key_len));
+    *inserted = true;
+    return group + key_len;
+  }
+  char* Find(const char* key, uint32_t len) const override {
+    Entry probe = {const_cast<char*>(key), len};
+    typename Map::const_iterator it = map_->find(probe);
+    return it == map_->end() ? nullptr : it->second;
+  }
+  size_t memory_usage() const override {
+    return *map_bytes_ + arena_.allocated();
+  }
+
+ private:
+  uint32_t payload_len_;
+  Map* map_;
+  size_t* map_bytes_;
+  Arena arena_;
+};
+
+typedef CountingAllocator<std::pair<const Entry, char*>> EntryAllocator;
+typedef std::map<Entry, char*, EntryCmp, EntryAllocator> EntryMap;
+typedef std::unordered_map<Entry, char*, EntryHash, EntryEq,
+                           EntryAllocator> EntryHashMap;
+
+GroupIndex* NewIndex(uint32_t index, uint32_t payload_len) {
+  switch (index) {
+    case kIndexGroupTable:
+    case kIndexGroupTableDense:
+      return new GroupTableIndex(payload_len,
+                                 index == kIndexGroupTableDense);
+    case kIndexStdMap: {
+      size_t* bytes = new size_t(0);
+      return new StdIndex<EntryMap>(
+          payload_len, new EntryMap(EntryCmp(), EntryAllocator(bytes)),
+          bytes);
+    }
+    default: {
+      size_t* bytes = new size_t(0);
+      return new StdIndex<EntryHashMap>(
+          payload_len,
+          new EntryHashMap(0, EntryHash(), EntryEq(), EntryAllocator(bytes)),
+          bytes);
+    }
+  }
+}
+
+/*
+ * Writes the key of group |id| at |buf|, as the interpreter encodes it.
+ */
+void EncodeKey(uint32_t key, uint64_t id, char* buf) {
+  switch (key) {
+    case kKeyBigInt:
+      buf[0] = kKeyNotNull;
+      memcpy(buf + 1, &id, sizeof(id));
+      break;
+    case kKeySparse: {
+      uint64_t value = id * GroupTable::kDensePageSize;
+      buf[0] = kKeyNotNull;
+      memcpy(buf + 1, &value, sizeof(value));
+      break;
+    }
+    case kKeyComposite: {
+      uint64_t cols[2] = {id >> 8, id & 0xFF};
+      buf[0] = kKeyNotNull;
+      memcpy(buf + 1, &cols[0], sizeof(cols[0]));
+      buf[1 + sizeof(cols[0])] = kKeyNotNull;
+      memcpy(buf + 2 + sizeof(cols[0]), &cols[1], sizeof(cols[1]));
+      break;
+    }
+    default: {
+      char letters[kKeyLetters + 1];
+      for (uint32_t i = 0; i < kKeyLetters; i++, id /= 26) {
+        letters[kKeyLetters - 1 - i] = 'a' + id % 26;
+      }
+      buf[0] = kKeyNotNull;
+      ColumnVarchar col(letters, sizeof(letters),
+                        reinterpret_cast<unsigned char*>(buf + 1));
+      break;
+    }
+  }
+}
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  bool ok = true;
+  int c;
+  while ((c = getopt(argc, argv, "n:k:h:i:q:p:r:s:")) != -1) {
+    switch (c) {
+      case 'n':
+        ok = ParseList(optarg, false, &opt.n_groups);
+        break;
+      case 'k':
+        ok = ParseNames(optarg, kKeyNames, kNumKeys, &opt.keys);
+        break;
+      case 'h':
+        ok = ParseList(optarg, true, &opt.hit_ratios);
+        for (uint64_t ratio : opt.hit_ratios) {
+          ok = ok && ratio <= 100;
+        }
+        break;
+      case 'i':
+        ok = ParseNames(optarg, kIndexNames, kNumIndexes, &opt.indexes);
+        break;
+      case 'q':
+        opt.n_probes = strtoull(optarg, nullptr, 10);
+        break;
+      case 'p':
+        opt.payload_len = strtoul(optarg, nullptr, 10);
+        break;
+      case 'r':
+        opt.runs = strtoul(optarg, nullptr, 10);
+        break;
+      case 's':
+        opt.seed = strtoull(optarg, nullptr, 10);
+        break;
+      default:
+        ok = false;
+        break;
+    }
+    if (!ok) {
+      fprintf(stderr, "Usage: %s [-n groups] [-k key_types] [-h hit_ratios] "
+              "[-i tables] [-q probes] [-p payload_len] [-r runs] "
+              "[-s seed]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (opt.n_probes == 0 || opt.runs == 0) {
+    fprintf(stderr, "Need at least one probe and one run\n");
+    return 1;
+  }
+  for (uint64_t n : opt.n_groups) {
+    if (n > UINT32_MAX / 2) {
+      fprintf(stderr, "Too many groups %llu\n",
+              static_cast<unsigned long long>(n));
+      return 1;
+    }
+  }
+
+  printf("{\n  \"payload_len\": %u,\n  \"probes\": %llu,\n  \"runs\": %u,\n"
+         "  \"seed\": %llu,\n  \"scenarios\": [",
+         opt.payload_len, static_cast<unsigned long long>(opt.n_probes),
+         opt.runs, static_cast<unsigned long long>(opt.seed));
+  bool first = true;
+  int ret = 0;
+  std::mt19937_64 gen(opt.seed);
+  for (uint64_t n_groups : opt.n_groups) {
+    // Ids [0, 2n) shuffled, the first n are the groups.
+    std::vector<uint64_t> ids(2 * n_groups);
+    for (uint64_t i = 0; i < ids.size(); i++) {
+      ids[i] = i;
+    }
+    std::shuffle(ids.begin(), ids.end(), gen);
+    for (uint32_t key : opt.keys) {
+      uint32_t width = kKeyWidths[key];
+      std::vector<char> keys(ids.size() * width);
+      for (uint64_t i = 0; i < ids.size(); i++) {
+        EncodeKey(key, ids[i], keys.data() + i * width);
+      }
+      for (uint32_t index : opt.indexes) {
+        if (index == kIndexGroupTableDense && key != kKeyBigInt &&
+            key != kKeySparse) {
+          continue;
+        }
+        GroupIndex* table = nullptr;
+        double insert_secs = 0;
+        for (uint32_t run = 0; run < opt.runs; run++) {
+          delete table;
+          table = NewIndex(index, opt.payload_len);
+          std::chrono::steady_clock::time_point start =
+              std::chrono::steady_clock::now();
+          for (uint64_t i = 0; i < n_groups; i++) {
+            bool inserted;
+            table->FindOrInsert(keys.data() + i * width, width, &inserted);
+          }
+          double secs = Seconds(start);
+          if (run == 0 || secs < insert_secs) {
+            insert_secs = secs;
+          }
+        }
+        double bytes_per_group =
+            static_cast<double>(table->memory_usage()) / n_groups;
+
+        for (uint64_t ratio : opt.hit_ratios) {
+          // The probe sequence is drawn before the clock starts.
+          std::uniform_int_distribution<uint64_t> group_dist(0, n_groups - 1);
+          std::uniform_int_distribution<uint64_t> ratio_dist(0, 99);
+          std::vector<const char*> probes(opt.n_probes);
+          uint64_t n_hits = 0;
+          for (uint64_t i = 0; i < opt.n_probes; i++) {
+            bool hit = ratio_dist(gen) < ratio;
+            n_hits += hit;
+            uint64_t k = group_dist(gen) + (hit ? 0 : n_groups);
+            probes[i] = keys.data() + k * width;
+          }
+          double probe_secs = 0;
+          uint64_t n_found = 0;
+          for (uint32_t run = 0; run < opt.runs; run++) {
+            n_found = 0;
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < opt.n_probes; i++) {
+              n_found += table->Find(probes[i], width) != nullptr;
+            }
+            double secs = Seconds(start);
+            if (run == 0 || secs < probe_secs) {
+              probe_secs = secs;
+            }
+          }
+          if (n_found != n_hits) {
+            fprintf(stderr, "%s found %llu of %llu %s keys\n",
+                    kIndexNames[index],
+                    static_cast<unsigned long long>(n_found),
+                    static_cast<unsigned long long>(n_hits), kKeyNames[key]);
+            ret = 1;
+          }
+          printf("%s\n    {\"table\": \"%s\", \"key\": \"%s\", "
+                 "\"key_len\": %u, \"groups\": %llu, \"hit_ratio\": %llu, "
+                 "\"insert_ns\": %.2f, \"probe_ns\": %.2f, "
+                 "\"bytes_per_group\": %.1f}",
+                 first ? "" : ",", kIndexNames[index], kKeyNames[key], width,
+                 static_cast<unsigned long long>(n_groups),
+                 static_cast<unsigned long long>(ratio),
+                 insert_secs * 1e9 / n_groups,
+                 probe_secs * 1e9 / opt.n_probes, bytes_per_group);
+          fflush(stdout);
+          first = false;
+        }
+        delete table;
+      }
+    }
+  }
+  printf("\n  ]\n}\n");
+  return ret;
+}
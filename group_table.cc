@@ -0,0 +1,413 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "group_table.h"
+
+namespace {
+
+const uint32_t kGroupWidth = 16;
+const uint32_t kInitCapacity = 64;
+const uint8_t kCtrlEmpty = 0x80;
+// Bytes in front of the key of a dense group, so its state is aligned.
+const uint32_t kDenseKeyPad =
+    (Arena::kAlign - GroupTable::kDenseKeyLen % Arena::kAlign) %
+    Arena::kAlign;
+const uint32_t kDenseKeyEnd = kDenseKeyPad + GroupTable::kDenseKeyLen;
+
+inline uint64_t Load64(const char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t Mix(uint64_t v) {
+  v ^= v >> 33;
+  v *= 0xFF51AFD7ED558CCDULL;
+  v ^= v >> 33;
+  v *= 0xC4CEB9FE1A85EC53ULL;
+  v ^= v >> 33;
+  return v;
+}
+
+inline uint8_t H2(uint64_t hash) {
+  return hash & 0x7F;
+}
+
+}  // namespace
+
+/*
+ * Group keys are mostly a few 8 bytes columns, so hash 8 bytes per step.
+ */
+uint64_t HashGroupKey(const char* key, uint32_t len) {
+  const uint64_t kMul = 0x9E3779B97F4A7C15ULL;
+  uint64_t h = len * kMul;
+  while (len >= 8) {
+    h = (h ^ Load64(key)) * kMul;
+    h ^= h >> 29;
+    key += 8;
+    len -= 8;
+  }
+  if (len) {
+    uint64_t v = 0;
+    memcpy(&v, key, len);
+    h = (h ^ v) * kMul;
+  }
+  return Mix(h);
+}
+
+namespace {
+
+/*
+ * Bit i is set if ctrl[i] == b, for the kGroupWidth bytes at |ctrl|.
+ */
+inline uint32_t MatchByte(const uint8_t* ctrl, uint8_t b) {
+#if defined(__SSE2__)
+  __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group,
+                                          _mm_set1_epi8(static_cast<char>(b))));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < kGroupWidth; i++) {
+    mask |= static_cast<uint32_t>(ctrl[i] == b) << i;
+  }
+  return mask;
+#endif
+}
+
+}  // namespace
+
+GroupTable::GroupTable(uint32_t payload_len)
+  : payload_len_(payload_len), capacity_(kInitCapacity), size_(0),
+    growth_left_(kInitCapacity / 8 * 7), dense_(false),
+    dense_unsigned_(false), dense_rec_len_(0), dense_pages_(nullptr),
+    dense_first_(0), n_dense_pages_(0), n_dense_groups_(0), hint_first_(1),
+    hint_last_(0), n_dense_keys_(0), dense_min_(0), dense_max_(0) {
+  ctrl_ = new uint8_t[capacity_];
+  memset(ctrl_, kCtrlEmpty, capacity_);
+  slots_ = new Slot[capacity_];
+}
+
+GroupTable::~GroupTable() {
+  delete[] ctrl_;
+  delete[] slots_;
+  delete[] dense_pages_;
+}
+
+void GroupTable::EnableDenseIndex(bool is_unsigned) {
+  assert(size_ == 0);
+  dense_ = true;
+  dense_unsigned_ = is_unsigned;
+  dense_rec_len_ = (kDenseKeyEnd + payload_len_ + Arena::kAlign - 1) &
+                   ~(Arena::kAlign - 1);
+}
+
+void GroupTable::EnableDenseIndex(bool is_unsigned, int64_t min,
+                                  int64_t max) {
+  EnableDenseIndex(is_unsigned);
+  if (min <= max &&
+      CoverDensePages(min >> kDensePageBits, max >> kDensePageBits)) {
+    hint_first_ = min >> kDensePageBits;
+    hint_last_ = max >> kDensePageBits;
+  }
+}
+
+/*
+ * Extends the page directory to cover pages [first, last] too, unless that
+ * would span more than kMaxDenseKeys keys.
+ */
+bool GroupTable::CoverDensePages(int64_t first, int64_t last) {
+  if (n_dense_pages_) {
+    int64_t cur_last = dense_first_ + n_dense_pages_ - 1;
+    first = first < dense_first_ ? first : dense_first_;
+    last = last > cur_last ? last : cur_last;
+  }
+  // Page numbers are within +-2^55, the span can't overflow.
+  if (last - first >= static_cast<int64_t>(kMaxDenseKeys / kDensePageSize)) {
+    return false;
+  }
+  uint32_t n_pages = last - first + 1;
+  char** pages = new char*[n_pages];
+  memset(pages, 0, n_pages * sizeof(char*));
+  if (n_dense_pages_) {
+    memcpy(pages + (dense_first_ - first), dense_pages_,
+           n_dense_pages_ * sizeof(char*));
+  }
+  delete[] dense_pages_;
+  dense_pages_ = pages;
+  dense_first_ = first;
+  n_dense_pages_ = n_pages;
+  return true;
+}
+
+/*
+ * Returns the directory entry of the page of |key|, nullptr if the key is
+ * out of the dense range. Keys out of it never go to a page later on: the
+ * range only grows, and covering them would have made it too wide already.
+ */
+char** GroupTable::DensePage(const char* key) const {
+  int64_t val = Load64(key + 1);
+  if (dense_unsigned_ && val < 0) {
+    return nullptr;
+  }
+  int64_t page_no = val >> kDensePageBits;
+  if (page_no < dense_first_ ||
+      page_no >= dense_first_ + static_cast<int64_t>(n_dense_pages_)) {
+    return nullptr;
+  }
+  return &dense_pages_[page_no - dense_first_];
+}
+
+/*
+ * Whether a new group of key |val| may get a page: within the range given,
+ * or if the keys, this one included, fill the pages of their range enough.
+ */
+bool GroupTable::DenseAllowed(int64_t val) const {
+  int64_t page_no = val >> kDensePageBits;
+  if (page_no >= hint_first_ && page_no <= hint_last_) {
+    return true;
+  }
+  int64_t min = n_dense_keys_ && dense_min_ < val ? dense_min_ : val;
+  int64_t max = n_dense_keys_ && dense_max_ > val ? dense_max_ : val;
+  uint64_t n_pages = static_cast<uint64_t>((max >> kDensePageBits) -
+                                           (min >> kDensePageBits)) + 1;
+  return n_pages <= kMaxDenseKeys / kDensePageSize &&
+         n_dense_keys_ + 1 >= n_pages * kDenseMinFill;
+}
+
+void GroupTable::AddDenseKey(int64_t val) {
+  if (n_dense_keys_ == 0 || val < dense_min_) {
+    dense_min_ = val;
+  }
+  if (n_dense_keys_ == 0 || val > dense_max_) {
+    dense_max_ = val;
+  }
+  n_dense_keys_++;
+}
+
+/*
+ * Returns nullptr if the group isn't in a page nor may be added to one, the
+ * hash table has it then.
+ */
+char* GroupTable::FindOrInsertDense(const char* key, bool* inserted) {
+  int64_t val = Load64(key + 1);
+  if (dense_unsigned_ && val < 0) {
+    return nullptr;
+  }
+  char** page = DensePage(key);
+  uint32_t i = val & (kDensePageSize - 1);
+  if (page && *page && (*page)[i]) {
+    *inserted = false;
+    return *page + kDensePageSize + i * dense_rec_len_ + kDenseKeyEnd;
+  }
+  if (size_ != n_dense_groups_) {
+    char* state = Probe(key, kDenseKeyLen, HashGroupKey(key, kDenseKeyLen));
+    if (state) {
+      *inserted = false;
+      return state;
+    }
+  }
+  if (page == nullptr || *page == nullptr) {
+    if (!DenseAllowed(val)) {
+      return nullptr;
+    }
+    if (page == nullptr) {
+      if (!CoverDensePages(val >> kDensePageBits, val >> kDensePageBits)) {
+        return nullptr;
+      }
+      page = DensePage(key);
+    }
+    uint32_t page_len = kDensePageSize + kDensePageSize * dense_rec_len_;
+    *page = arena_.Allocate(page_len);
+    memset(*page, 0, page_len);
+  }
+  char* rec = *page + kDensePageSize + i * dense_rec_len_;
+  (*page)[i] = 1;
+  memcpy(rec + kDenseKeyPad, key, kDenseKeyLen);
+  size_++;
+  n_dense_groups_++;
+  AddDenseKey(val);
+  *inserted = true;
+  return rec + kDenseKeyEnd;
+}
+
+char* GroupTable::FindOrInsert(const char* key, uint32_t len,
+                               bool* inserted) {
+  bool dense_key = false;
+  if (dense_ && len == kDenseKeyLen && key[0] == kKeyNotNull) {
+    char* state = FindOrInsertDense(key, inserted);
+    if (state) {
+      return state;
+    }
+    // Unless negative and unsigned, it was looked up in the hash table.
+    dense_key = !dense_unsigned_ ||
+                static_cast<int64_t>(Load64(key + 1)) >= 0;
+  }
+
+  uint64_t hash = HashGroupKey(key, len);
+  char* state = dense_key ? nullptr : Probe(key, len, hash);
+  if (state) {
+    *inserted = false;
+    return state;
+  }
+
+  if (growth_left_ == 0) {
+    Grow();
+  }
+  uint32_t pos = FindEmpty(hash);
+  // Pad in front of the key so the state after it is aligned.
+  uint32_t pad = (Arena::kAlign - len % Arena::kAlign) % Arena::kAlign;
+  char* ptr = arena_.Allocate(pad + len + payload_len_) + pad;
+  memcpy(ptr, key, len);
+  memset(ptr + len, 0, payload_len_);
+  ctrl_[pos] = H2(hash);
+  slots_[pos] = Slot{hash, ptr, len};
+  size_++;
+  growth_left_--;
+  if (dense_key) {
+    AddDenseKey(Load64(key + 1));
+  }
+  *inserted = true;
+  return ptr + len;
+}
+
+char* GroupTable::Find(const char* key, uint32_t len) const {
+  if (dense_ && len == kDenseKeyLen && key[0] == kKeyNotNull) {
+    char** page = DensePage(key);
+    uint32_t i = Load64(key + 1) & (kDensePageSize - 1);
+    if (page && *page && (*page)[i]) {
+      return *page + kDensePageSize + i * dense_rec_len_ + kDenseKeyEnd;
+    }
+  }
+  if (size_ == n_dense_groups_) {
+    return nullptr;
+  }
+  return Probe(key, len, HashGroupKey(key, len));
+}
+
+/*
+ * Probes group by group with triangular steps, which visits every group
+ * since their number is a power of 2.
+ */
+char* GroupTable::Probe(const char* key, uint32_t len, uint64_t hash) const {
+  uint8_t h2 = H2(hash);
+  uint32_t mask = capacity_ / kGroupWidth - 1;
+  uint32_t group = (hash >> 7) & mask;
+  for (uint32_t step = 1; ; step++) {
+    const uint8_t* ctrl = ctrl_ + group * kGroupWidth;
+    uint32_t match = MatchByte(ctrl, h2);
+    while (match) {
+      const Slot& slot = slots_[group * kGroupWidth + __builtin_ctz(match)];
+      if (slot.hash == hash && slot.len == len &&
+          memcmp(slot.ptr, key, len) == 0) {
+        return slot.ptr + len;
+      }
+      match &= match - 1;
+    }
+    if (MatchByte(ctrl, kCtrlEmpty)) {
+      return nullptr;
+    }
+    group = (group + step) & mask;
+  }
+}
+
+size_t GroupTable::memory_usage() const {
+  return arena_.allocated() + capacity_ * (sizeof(uint8_t) + sizeof(Slot)) +
+         n_dense_pages_ * sizeof(char*);
+}
+
+/*
+ * Growing the slots, or a new arena block or dense page for the group.
+ */
+size_t GroupTable::insert_cost() const {
+  size_t cost = 0;
+  if (growth_left_ == 0) {
+    cost += 2 * capacity_ * (sizeof(uint8_t) + sizeof(Slot));
+  }
+  size_t page_len = dense_ ? kDensePageSize * (1 + dense_rec_len_) : 0;
+  return cost + (page_len > Arena::kDefaultBlockSize ?
+                 page_len : Arena::kDefaultBlockSize);
+}
+
+uint32_t GroupTable::FindEmpty(uint64_t hash) const {
+  uint32_t mask = capacity_ / kGroupWidth - 1;
+  uint32_t group = (hash >> 7) & mask;
+  for (uint32_t step = 1; ; step++) {
+    uint32_t empty = MatchByte(ctrl_ + group * kGroupWidth, kCtrlEmpty);
+    if (empty) {
+      return group * kGroupWidth + __builtin_ctz(empty);
+    }
+    group = (group + step) & mask;
+  }
+}
+
+void GroupTable::Grow() {
+  uint8_t* old_ctrl = ctrl_;
+  Slot* old_slots = slots_;
+  uint32_t old_capacity = capacity_;
+
+  capacity_ *= 2;
+  ctrl_ = new uint8_t[capacity_];
+  memset(ctrl_, kCtrlEmpty, capacity_);
+  slots_ = new Slot[capacity_];
+  uint32_t n_slots = 0;
+  for (uint32_t i = 0; i < old_capacity; i++) {
+    if (old_ctrl[i] != kCtrlEmpty) {
+      uint32_t pos = FindEmpty(old_slots[i].hash);
+      ctrl_[pos] = H2(old_slots[i].hash);
+      slots_[pos] = old_slots[i];
+      n_slots++;
+    }
+  }
+  // size_ also counts the groups in the dense pages.
+  growth_left_ = capacity_ / 8 * 7 - n_slots;
+  delete[] old_ctrl;
+  delete[] old_slots;
+}
+
+void GroupTable::GetEntries(Entry* entries) const {
+  uint64_t pos = 0;
+  uint32_t n = 0;
+  while (Next(&pos, &entries[n])) {
+    n++;
+  }
+  assert(n == size_);
+}
+
+/*
+ * Positions run over every key of the dense pages, then every slot.
+ */
+bool GroupTable::Next(uint64_t* pos, Entry* entry) const {
+  uint64_t n_dense = static_cast<uint64_t>(n_dense_pages_) * kDensePageSize;
+  while (*pos < n_dense) {
+    uint64_t page_no = *pos >> kDensePageBits;
+    const char* page = dense_pages_[page_no];
+    if (page == nullptr) {
+      *pos = (page_no + 1) << kDensePageBits;
+      continue;
+    }
+    uint32_t i = *pos & (kDensePageSize - 1);
+    (*pos)++;
+    if (page[i]) {
+      *entry = Entry{const_cast<char*>(page) + kDensePageSize +
+                     i * dense_rec_len_ + kDenseKeyPad, kDenseKeyLen};
+      return true;
+    }
+  }
+  while (*pos - n_dense < capacity_) {
+    uint32_t i = *pos - n_dense;
+    (*pos)++;
+    if (ctrl_[i] != kCtrlEmpty) {
+      *entry = Entry{slots_[i].ptr, slots_[i].len};
+      return true;
+    }
+  }
+  return false;
+}
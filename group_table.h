@@ -0,0 +1,125 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef GROUP_TABLE_H_
+#define GROUP_TABLE_H_
+
+#include "arena.h"
+#include "interpreter.h"
+
+uint64_t HashGroupKey(const char* key, uint32_t len);
+
+/*
+ * Open-addressing hash table from a GROUP BY key to the aggregation state of
+ * its group, laid out after the swiss table: a control byte per slot holds 7
+ * bits of the key hash, and a lookup compares a whole group of 16 control
+ * bytes at once before touching any key. A group is the key followed by
+ * |payload_len| bytes of state, 8 bytes aligned, bump-allocated in an arena
+ * so it stays in place when the table grows. Groups are never removed, the
+ * arena frees them all at once with the table.
+ *
+ * When the key is a single BIGINT, EnableDenseIndex() keeps the groups of
+ * non-NULL keys within a narrow range in pages indexed by the key itself,
+ * skipping the hash and probe. Pages cover kDensePageSize keys each and are
+ * allocated on first use, but only for keys within the range given to
+ * EnableDenseIndex(), or once the keys seen hold kDenseMinFill groups per
+ * page over the range they span, so sparse keys don't take a page each. The
+ * range the pages may span follows the keys seen, up to kMaxDenseKeys keys.
+ * Other keys go to the hash table, and a key missing from its page is
+ * looked up there too, as it may have gone there before the page was.
+ */
+class GroupTable {
+ public:
+  static const uint32_t kDensePageBits = 8;
+  static const uint32_t kDensePageSize = 1U << kDensePageBits;
+  static const uint32_t kMaxDenseKeys = 1U << 20;
+  static const uint32_t kDenseMinFill = kDensePageSize / 4;
+  static const uint32_t kDenseKeyLen = 1 + sizeof(int64_t);
+
+  explicit GroupTable(uint32_t payload_len);
+  ~GroupTable();
+
+  /*
+   * Keys are a single 8 bytes integer, signed or not, kDenseKeyLen bytes
+   * with the kKeyNotNull flag in front, or NULL. If [min, max] is given,
+   * it's where the keys are expected and its pages are used whatever the
+   * keys seen.
+   */
+  void EnableDenseIndex(bool is_unsigned);
+  void EnableDenseIndex(bool is_unsigned, int64_t min, int64_t max);
+
+  /*
+   * Returns the state of the group keyed by [key, key + len), adding it
+   * with a zeroed state first if it's new. |inserted| tells which happened.
+   */
+  char* FindOrInsert(const char* key, uint32_t len, bool* inserted);
+  /*
+   * Returns the state of the group keyed by [key, key + len), nullptr if
+   * there is no such group.
+   */
+  char* Find(const char* key, uint32_t len) const;
+
+  uint32_t size() const {
+    return size_;
+  }
+  /*
+   * Bytes held by the table, and the most FindOrInsert() may add to it
+   * when it inserts the next group.
+   */
+  size_t memory_usage() const;
+  size_t insert_cost() const;
+  /*
+   * Fills |entries|, size() of them, with the keys of all groups in no
+   * particular order. The state of a group directly follows its key.
+   */
+  void GetEntries(Entry* entries) const;
+  /*
+   * Walks the groups in the same order without an array: starting from
+   * *pos == 0, each call sets |entry| to the next group and returns false
+   * past the last. No group may be added during the walk.
+   */
+  bool Next(uint64_t* pos, Entry* entry) const;
+
+ private:
+  struct Slot {
+    uint64_t hash;
+    char* ptr;
+    uint32_t len;
+  };
+
+  uint32_t FindEmpty(uint64_t hash) const;
+  void Grow();
+  char* Probe(const char* key, uint32_t len, uint64_t hash) const;
+  bool CoverDensePages(int64_t first, int64_t last);
+  char** DensePage(const char* key) const;
+  bool DenseAllowed(int64_t val) const;
+  void AddDenseKey(int64_t val);
+  char* FindOrInsertDense(const char* key, bool* inserted);
+
+  uint32_t payload_len_;
+  uint32_t capacity_;
+  uint32_t size_;
+  uint32_t growth_left_;
+  uint8_t* ctrl_;
+  Slot* slots_;
+  Arena arena_;
+
+  bool dense_;
+  bool dense_unsigned_;
+  uint32_t dense_rec_len_;  // key and state of a group in a page
+  char** dense_pages_;  // each page: kDensePageSize flags, then the groups
+  int64_t dense_first_;  // page number of dense_pages_[0]
+  uint32_t n_dense_pages_;
+  uint32_t n_dense_groups_;  // groups in the pages
+  // Pages of the range given, empty if none.
+  int64_t hint_first_;
+  int64_t hint_last_;
+  // Groups of keys a page could hold, wherever they are, and their range.
+  uint32_t n_dense_keys_;
+  int64_t dense_min_;
+  int64_t dense_max_;
+};
+
+#endif  // GROUP_TABLE_H_
@@ -0,0 +1,262 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+
+#include "agg_kernels.h"
+#include "having.h"
+
+namespace {
+
+const uint32_t kHavingMagic = 0x0722;
+
+void DecodeHavingInstruction(uint32_t value, Instruction* inst) {
+  DecodeInstruction(value, inst);
+  switch (inst->op) {
+    case kOpLoadConst:
+      inst->reg = (value & 0x000F0000) >> 16;
+      break;
+    case kOpEq:
+    case kOpNe:
+    case kOpLt:
+    case kOpLe:
+    case kOpGt:
+    case kOpGe:
+    case kOpAnd:
+    case kOpOr:
+      inst->is_unsigned2 = (value & 0x00100000) != 0;
+      inst->type2 = (value & 0x000F0000) >> 16;
+      inst->reg = (value & 0x0000F000) >> 12;
+      inst->reg2 = (value & 0x00000F00) >> 8;
+      break;
+    default:
+      break;
+  }
+}
+
+bool IsArith(uint8_t op) {
+  return op >= kOpPlus && op <= kOpMod;
+}
+
+bool IsBinary(uint8_t op) {
+  return IsArith(op) || (op >= kOpEq && op <= kOpOr);
+}
+
+double AsDouble(const Register& reg) {
+  if (reg.type == kTypeDouble) {
+    return reg.value.val_double;
+  }
+  return reg.is_unsigned ? static_cast<double>(reg.value.val_uint64) :
+                           static_cast<double>(reg.value.val_int64);
+}
+
+int CompareRegisters(const Register& a, const Register& b) {
+  if (a.type == kTypeDouble || b.type == kTypeDouble) {
+    double x = AsDouble(a);
+    double y = AsDouble(b);
+    return (x > y) - (x < y);
+  }
+  bool a_neg = !a.is_unsigned && a.value.val_int64 < 0;
+  bool b_neg = !b.is_unsigned && b.value.val_int64 < 0;
+  if (a_neg != b_neg) {
+    return a_neg ? -1 : 1;
+  }
+  if (a_neg) {
+    return (a.value.val_int64 > b.value.val_int64) -
+           (a.value.val_int64 < b.value.val_int64);
+  }
+  return (a.value.val_uint64 > b.value.val_uint64) -
+         (a.value.val_uint64 < b.value.val_uint64);
+}
+
+bool IsTrue(const Register& reg) {
+  return !reg.is_null && (reg.type == kTypeDouble ?
+                          reg.value.val_double != 0 :
+                          reg.value.val_int64 != 0);
+}
+
+bool IsFalse(const Register& reg) {
+  return !reg.is_null && !IsTrue(reg);
+}
+
+void SetBool(bool value, bool is_null, Register* reg) {
+  reg->type = kTypeBigInt;
+  reg->value.val_int64 = value;
+  reg->is_unsigned = false;
+  reg->is_null = is_null;
+}
+
+}  // namespace
+
+HavingFilter::HavingFilter(const uint32_t* prog, uint32_t prog_len)
+  : prog_(prog), prog_len_(prog_len), insts_(nullptr), consts_(nullptr),
+    n_insts_(0) {
+}
+
+HavingFilter::~HavingFilter() {
+  delete[] insts_;
+  delete[] consts_;
+}
+
+VerifyError HavingFilter::Init(const AggResItem* agg_results,
+                               uint32_t n_aggs) {
+  if (prog_len_ < 1 || ((prog_[0] & 0xFFFF0000) >> 16) != kHavingMagic ||
+      (prog_[0] & 0xFFFF) != prog_len_) {
+    return kVerifyBadHeader;
+  }
+  insts_ = new Instruction[prog_len_];
+  consts_ = new DataValue[prog_len_];
+
+  // Signedness of a BIGINT result is only known per group, types are not.
+  bool inited[kRegTotal];
+  DataType types[kRegTotal];
+  memset(inited, 0, sizeof(inited));
+  for (uint32_t pos = 1; pos < prog_len_; pos++) {
+    Instruction* inst = &insts_[n_insts_];
+    DecodeHavingInstruction(prog_[pos], inst);
+    if (inst->reg >= kRegTotal || inst->reg2 >= kRegTotal) {
+      return kVerifyBadReg;
+    }
+    if (IsBinary(inst->op)) {
+      if (!inited[inst->reg] || !inited[inst->reg2]) {
+        return kVerifyUninitReg;
+      }
+      if (inst->type != types[inst->reg] ||
+          inst->type2 != types[inst->reg2]) {
+        return kVerifyOperandMismatch;
+      }
+      if (!IsArith(inst->op)) {
+        types[inst->reg] = kTypeBigInt;
+      } else if (types[inst->reg2] == kTypeDouble) {
+        types[inst->reg] = kTypeDouble;
+      }
+    } else if (inst->op == kOpMov) {
+      if (!inited[inst->reg2]) {
+        return kVerifyUninitReg;
+      }
+      types[inst->reg] = types[inst->reg2];
+      inited[inst->reg] = true;
+    } else if (inst->op == kOpLoadCol) {
+      if (inst->index >= n_aggs) {
+        return kVerifyBadAggIndex;
+      }
+      // COUNT results may have no type, they hold a BIGINT.
+      DataType type = agg_results[inst->index].type == kTypeDouble ?
+                      kTypeDouble : kTypeBigInt;
+      if (inst->type != type) {
+        return kVerifyAggTypeMismatch;
+      }
+      types[inst->reg] = type;
+      inited[inst->reg] = true;
+    } else if (inst->op == kOpLoadConst) {
+      if (inst->type != kTypeBigInt && inst->type != kTypeDouble) {
+        return kVerifyOperandMismatch;
+      }
+      if (pos + 2 >= prog_len_) {
+        return kVerifyBadHeader;
+      }
+      uint64_t value = prog_[pos + 1] |
+                       static_cast<uint64_t>(prog_[pos + 2]) << 32;
+      memcpy(&consts_[n_insts_], &value, sizeof(value));
+      pos += 2;
+      types[inst->reg] = inst->type;
+      inited[inst->reg] = true;
+    } else {
+      return kVerifyBadOp;
+    }
+    n_insts_++;
+  }
+  if (!inited[kReg1]) {
+    return kVerifyUninitReg;
+  }
+  return kVerifyOk;
+}
+
+bool HavingFilter::Pass(const AggResItem* items) const {
+  Register regs[kRegTotal];
+  for (uint32_t i = 0; i < n_insts_; i++) {
+    const Instruction& inst = insts_[i];
+    Register* a = &regs[inst.reg];
+    const Register& b = regs[inst.reg2];
+    switch (inst.op) {
+      case kOpLoadCol: {
+        const AggResItem& item = items[inst.index];
+        a->type = item.type == kTypeDouble ? kTypeDouble : kTypeBigInt;
+        a->value = item.value;
+        a->is_unsigned = item.is_unsigned;
+        a->is_null = false;
+        break;
+      }
+      case kOpLoadConst:
+        a->type = inst.type;
+        a->value = consts_[i];
+        a->is_unsigned = inst.is_unsigned;
+        a->is_null = false;
+        break;
+      case kOpPlus:
+      case kOpMinus:
+      case kOpMul:
+      case kOpDiv:
+      case kOpMod:
+        if (GetArithKernel(inst.op)(*a, b, a) < 0) {
+          // Overflow, the kernel left |a| as it was.
+          a->is_null = true;
+        }
+        break;
+      case kOpMov:
+        *a = b;
+        break;
+      case kOpEq:
+      case kOpNe:
+      case kOpLt:
+      case kOpLe:
+      case kOpGt:
+      case kOpGe: {
+        bool is_null = a->is_null || b.is_null;
+        int cmp = is_null ? 0 : CompareRegisters(*a, b);
+        bool res = false;
+        switch (inst.op) {
+          case kOpEq:
+            res = cmp == 0;
+            break;
+          case kOpNe:
+            res = cmp != 0;
+            break;
+          case kOpLt:
+            res = cmp < 0;
+            break;
+          case kOpLe:
+            res = cmp <= 0;
+            break;
+          case kOpGt:
+            res = cmp > 0;
+            break;
+          default:
+            res = cmp >= 0;
+            break;
+        }
+        SetBool(res && !is_null, is_null, a);
+        break;
+      }
+      case kOpAnd:
+        if (IsFalse(*a) || IsFalse(b)) {
+          SetBool(false, false, a);
+        } else {
+          SetBool(!a->is_null && !b.is_null, a->is_null || b.is_null, a);
+        }
+        break;
+      case kOpOr:
+        if (IsTrue(*a) || IsTrue(b)) {
+          SetBool(true, false, a);
+        } else {
+          SetBool(false, a->is_null || b.is_null, a);
+        }
+        break;
+      default:
+        assert(0);
+    }
+  }
+  return IsTrue(regs[kReg1]);
+}
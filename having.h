@@ -0,0 +1,60 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef HAVING_H_
+#define HAVING_H_
+
+#include "interpreter.h"
+
+/*
+ * Ops only a HAVING program has, numbered apart from the aggregation ones.
+ * LOADCONST is encoded like LOADCOL without the index and followed by the
+ * 64 bits of the constant in 2 words, low word first. The comparisons and
+ * AND/OR are encoded like the arithmetic and leave BIGINT 1 or 0 in reg.
+ */
+enum HavingOp {
+  kOpLoadConst = 32,
+  kOpEq,
+  kOpNe,
+  kOpLt,
+  kOpLe,
+  kOpGt,
+  kOpGe,
+  kOpAnd,
+  kOpOr,
+  kHavingOpTotal
+};
+
+/*
+ * A HAVING predicate, run over the agg results of every group once the
+ * aggregation is done. Its program has the header 0x0722 << 16 | length
+ * followed by instructions in the format of the aggregation program, where
+ * LOADCOL loads agg result |index| rather than a column, besides PLUS to
+ * MOD, MOV and the ops above. A group passes if kReg1 holds a non-zero,
+ * non-NULL value at the end. As in SQL, comparing a NULL gives NULL, and
+ * so does an overflow or a division by zero.
+ */
+class HavingFilter {
+ public:
+  HavingFilter(const uint32_t* prog, uint32_t prog_len);
+  ~HavingFilter();
+
+  /*
+   * Checks the program like VerifyProgram() does, against the result types
+   * of |agg_results|: registers written before read, operand types as
+   * inferred, LOADCOL of an existing result of its type, and kReg1 set.
+   */
+  VerifyError Init(const AggResItem* agg_results, uint32_t n_aggs);
+  bool Pass(const AggResItem* items) const;
+
+ private:
+  const uint32_t* prog_;
+  uint32_t prog_len_;
+  Instruction* insts_;
+  DataValue* consts_;  // the constant of each LOADCONST
+  uint32_t n_insts_;
+};
+
+#endif  // HAVING_H_
@@ -5,11 +5,20 @@
  */
 #include <assert.h>
 #include <stdio.h>
+#include <algorithm>
 #include <climits>
 #include <utility>
 #include <limits>
 
 #include "interpreter.h"
+#include "group_table.h"
+#include "agg_kernels.h"
+#include "having.h"
+#include "optimizer.h"
+#include "result_cursor.h"
+#include "spill.h"
+#include "topn.h"
+#include "verifier.h"
 
 #define INT_MIN64 (~0x7FFFFFFFFFFFFFFFLL)
 #define INT_MAX64 0x7FFFFFFFFFFFFFFFLL
@@ -41,12 +50,51 @@ void ResetRegister(Register* reg) {
   SetRegisterNull(reg);
 }
 
-int32_t RegPlusReg(const Register& a, const Register& b, Register* res) {
+/*
+ * What an arithmetic operand is known to hold. The kernels below are
+ * instantiated once per pair of kinds, so the checks on the operand types and
+ * signedness are resolved at compile time.
+ */
+enum OperandKind {
+  kKindInt64 = 0,
+  kKindUint64,
+  kKindDouble,
+  kKindTotal
+};
+
+constexpr DataType KindType(OperandKind kind) {
+  return kind == kKindDouble ? kTypeDouble : kTypeBigInt;
+}
+
+constexpr bool KindUnsigned(OperandKind kind) {
+  return kind == kKindUint64;
+}
+
+OperandKind KindOf(DataType type, bool is_unsigned) {
+  if (type == kTypeDouble) {
+    return kKindDouble;
+  }
+  return is_unsigned ? kKindUint64 : kKindInt64;
+}
+
+OperandKind ResultKind(OperandKind a, OperandKind b) {
+  if (a == kKindDouble || b == kKindDouble) {
+    return kKindDouble;
+  }
+  return (a == kKindUint64 || b == kKindUint64) ? kKindUint64 : kKindInt64;
+}
+
+template <OperandKind kA, OperandKind kB>
+int32_t Plus(const Register& a, const Register& b, Register* res) {
+  const DataType a_type = KindType(kA);
+  const DataType b_type = KindType(kB);
+  const bool a_unsigned = KindUnsigned(kA);
+  const bool b_unsigned = KindUnsigned(kB);
   DataType res_type = kTypeUnknown;
-  if (a.type == kTypeDouble || b.type == kTypeDouble) {
+  if (a_type == kTypeDouble || b_type == kTypeDouble) {
     res_type = kTypeDouble;
   } else {
-    assert(a.type == kTypeBigInt && b.type == kTypeBigInt);
+    assert(a_type == kTypeBigInt && b_type == kTypeBigInt);
     res_type = kTypeBigInt;
   }
 
@@ -62,8 +110,8 @@ int32_t RegPlusReg(const Register& a, const Register& b, Register* res) {
     int64_t res_val = static_cast<uint64_t>(val0) + static_cast<uint64_t>(val1);
     bool res_unsigned = false;
 
-    if (a.is_unsigned) {
-      if (b.is_unsigned || val1 >= 0) {
+    if (a_unsigned) {
+      if (b_unsigned || val1 >= 0) {
         if (TestIfSumOverflowsUint64((uint64_t)val0, (uint64_t)val1)) {
           // overflows;
           return -1;
@@ -76,7 +124,7 @@ int32_t RegPlusReg(const Register& a, const Register& b, Register* res) {
         }
       }
     } else {
-      if (b.is_unsigned) {
+      if (b_unsigned) {
         if (val0 >= 0) {
           if (TestIfSumOverflowsUint64((uint64_t)val0, (uint64_t)val1)) {
             // overflows;
@@ -102,10 +150,10 @@ int32_t RegPlusReg(const Register& a, const Register& b, Register* res) {
     // Check if res_val is overflow
     bool unsigned_flag = false;
     if (res_type == kTypeBigInt) {
-      unsigned_flag = (a.is_unsigned | b.is_unsigned);
+      unsigned_flag = (a_unsigned | b_unsigned);
     } else {
       assert(res_type == kTypeDouble);
-      unsigned_flag = (a.is_unsigned & b.is_unsigned);
+      unsigned_flag = (a_unsigned & b_unsigned);
     }
     if ((unsigned_flag && !res_unsigned && res_val < 0) ||
         (!unsigned_flag && res_unsigned &&
@@ -120,14 +168,14 @@ int32_t RegPlusReg(const Register& a, const Register& b, Register* res) {
     }
     res->is_unsigned = unsigned_flag;
   } else {
-    double val0 = (a.type == kTypeDouble) ?
+    double val0 = (a_type == kTypeDouble) ?
                      a.value.val_double :
-                     ((a.is_unsigned == true) ?
+                     ((a_unsigned == true) ?
                        static_cast<double>(a.value.val_uint64) :
                        static_cast<double>(a.value.val_int64));
-    double val1 = (b.type == kTypeDouble) ?
+    double val1 = (b_type == kTypeDouble) ?
                      b.value.val_double :
-                     ((b.is_unsigned == true) ?
+                     ((b_unsigned == true) ?
                        static_cast<double>(b.value.val_uint64) :
                        static_cast<double>(b.value.val_int64));
     double res_val = val0 + val1;
@@ -145,12 +193,17 @@ int32_t RegPlusReg(const Register& a, const Register& b, Register* res) {
   return 0;
 }
 
-int32_t RegMinusReg(const Register& a, const Register& b, Register* res) {
+template <OperandKind kA, OperandKind kB>
+int32_t Minus(const Register& a, const Register& b, Register* res) {
+  const DataType a_type = KindType(kA);
+  const DataType b_type = KindType(kB);
+  const bool a_unsigned = KindUnsigned(kA);
+  const bool b_unsigned = KindUnsigned(kB);
   DataType res_type = kTypeUnknown;
-  if (a.type == kTypeDouble || b.type == kTypeDouble) {
+  if (a_type == kTypeDouble || b_type == kTypeDouble) {
     res_type = kTypeDouble;
   } else {
-    assert(a.type == kTypeBigInt && b.type == kTypeBigInt);
+    assert(a_type == kTypeBigInt && b_type == kTypeBigInt);
     res_type = kTypeBigInt;
   }
 
@@ -166,8 +219,8 @@ int32_t RegMinusReg(const Register& a, const Register& b, Register* res) {
     int64_t res_val = static_cast<uint64_t>(val0) - static_cast<uint64_t>(val1);
     bool res_unsigned = false;
 
-    if (a.is_unsigned) {
-      if (b.is_unsigned) {
+    if (a_unsigned) {
+      if (b_unsigned) {
         if (static_cast<uint64_t>(val0) < static_cast<uint64_t>(val1)) {
           if (res_val >= 0) {
             // overflow
@@ -191,7 +244,7 @@ int32_t RegMinusReg(const Register& a, const Register& b, Register* res) {
         }
       }
     } else {
-      if (b.is_unsigned) {
+      if (b_unsigned) {
         if (static_cast<uint64_t>(val0) - LLONG_MIN <
             static_cast<uint64_t>(val1)) {
           // overflow
@@ -209,10 +262,10 @@ int32_t RegMinusReg(const Register& a, const Register& b, Register* res) {
     // Check if res_val is overflow
     bool unsigned_flag = false;
     if (res_type == kTypeBigInt) {
-      unsigned_flag = (a.is_unsigned | b.is_unsigned);
+      unsigned_flag = (a_unsigned | b_unsigned);
     } else {
       assert(res_type == kTypeDouble);
-      unsigned_flag = (a.is_unsigned & b.is_unsigned);
+      unsigned_flag = (a_unsigned & b_unsigned);
     }
     if ((unsigned_flag && !res_unsigned && res_val < 0) ||
         (!unsigned_flag && res_unsigned &&
@@ -228,14 +281,14 @@ int32_t RegMinusReg(const Register& a, const Register& b, Register* res) {
     res->is_unsigned = unsigned_flag;
   } else {
     assert(res_type == kTypeDouble);
-    double val0 = (a.type == kTypeDouble) ?
+    double val0 = (a_type == kTypeDouble) ?
                      a.value.val_double :
-                     ((a.is_unsigned == true) ?
+                     ((a_unsigned == true) ?
                        static_cast<double>(a.value.val_uint64) :
                        static_cast<double>(a.value.val_int64));
-    double val1 = (b.type == kTypeDouble) ?
+    double val1 = (b_type == kTypeDouble) ?
                      b.value.val_double :
-                     ((b.is_unsigned == true) ?
+                     ((b_unsigned == true) ?
                        static_cast<double>(b.value.val_uint64) :
                        static_cast<double>(b.value.val_int64));
     double res_val = val0 - val1;
@@ -250,12 +303,17 @@ int32_t RegMinusReg(const Register& a, const Register& b, Register* res) {
   return 0;
 }
 
-int32_t RegMulReg(const Register& a, const Register& b, Register* res) {
+template <OperandKind kA, OperandKind kB>
+int32_t Mul(const Register& a, const Register& b, Register* res) {
+  const DataType a_type = KindType(kA);
+  const DataType b_type = KindType(kB);
+  const bool a_unsigned = KindUnsigned(kA);
+  const bool b_unsigned = KindUnsigned(kB);
   DataType res_type = kTypeUnknown;
-  if (a.type == kTypeDouble || b.type == kTypeDouble) {
+  if (a_type == kTypeDouble || b_type == kTypeDouble) {
     res_type = kTypeDouble;
   } else {
-    assert(a.type == kTypeBigInt && b.type == kTypeBigInt);
+    assert(a_type == kTypeBigInt && b_type == kTypeBigInt);
     res_type = kTypeBigInt;
   }
 
@@ -273,12 +331,14 @@ int32_t RegMulReg(const Register& a, const Register& b, Register* res) {
     uint64_t res_val1;
 
     if (val0 == 0 || val1 == 0) {
+      res->value.val_int64 = 0;
+      res->is_unsigned = (a_unsigned | b_unsigned);
       res->type = res_type;
       return 0;
     }
 
-    const bool a_negative = (!a.is_unsigned && val0 < 0);
-    const bool b_negative = (!b.is_unsigned && val1 < 0);
+    const bool a_negative = (!a_unsigned && val0 < 0);
+    const bool b_negative = (!b_unsigned && val1 < 0);
     const bool res_unsigned = (a_negative == b_negative);
 
     if (a_negative && val0 == INT_MIN64) {
@@ -286,10 +346,10 @@ int32_t RegMulReg(const Register& a, const Register& b, Register* res) {
         // Check if val0 is overflow
         bool unsigned_flag = false;
         if (res_type == kTypeBigInt) {
-          unsigned_flag = (a.is_unsigned | b.is_unsigned);
+          unsigned_flag = (a_unsigned | b_unsigned);
         } else {
           assert(res_type == kTypeDouble);
-          unsigned_flag = (a.is_unsigned & b.is_unsigned);
+          unsigned_flag = (a_unsigned & b_unsigned);
         }
         if ((unsigned_flag && !res_unsigned && val0 < 0) ||
             (!unsigned_flag && res_unsigned &&
@@ -312,10 +372,10 @@ int32_t RegMulReg(const Register& a, const Register& b, Register* res) {
         // Check if val1 is overflow
         bool unsigned_flag = false;
         if (res_type == kTypeBigInt) {
-          unsigned_flag = (a.is_unsigned | b.is_unsigned);
+          unsigned_flag = (a_unsigned | b_unsigned);
         } else {
           assert(res_type == kTypeDouble);
-          unsigned_flag = (a.is_unsigned & b.is_unsigned);
+          unsigned_flag = (a_unsigned & b_unsigned);
         }
         if ((unsigned_flag && !res_unsigned && val1 < 0) ||
             (!unsigned_flag && res_unsigned &&
@@ -378,10 +438,10 @@ int32_t RegMulReg(const Register& a, const Register& b, Register* res) {
     // Check if res_val is overflow
     bool unsigned_flag = false;
     if (res_type == kTypeBigInt) {
-      unsigned_flag = (a.is_unsigned | b.is_unsigned);
+      unsigned_flag = (a_unsigned | b_unsigned);
     } else {
       assert(res_type == kTypeDouble);
-      unsigned_flag = (a.is_unsigned & b.is_unsigned);
+      unsigned_flag = (a_unsigned & b_unsigned);
     }
     if ((unsigned_flag && !res_unsigned && res_val < 0) ||
         (!unsigned_flag && res_unsigned &&
@@ -397,14 +457,14 @@ int32_t RegMulReg(const Register& a, const Register& b, Register* res) {
     res->is_unsigned = unsigned_flag;
   } else {
     assert(res_type == kTypeDouble);
-    double val0 = (a.type == kTypeDouble) ?
+    double val0 = (a_type == kTypeDouble) ?
                      a.value.val_double :
-                     ((a.is_unsigned == true) ?
+                     ((a_unsigned == true) ?
                        static_cast<double>(a.value.val_uint64) :
                        static_cast<double>(a.value.val_int64));
-    double val1 = (b.type == kTypeDouble) ?
+    double val1 = (b_type == kTypeDouble) ?
                      b.value.val_double :
-                     ((b.is_unsigned == true) ?
+                     ((b_unsigned == true) ?
                        static_cast<double>(b.value.val_uint64) :
                        static_cast<double>(b.value.val_int64));
     double res_val = val0 * val1;
@@ -419,12 +479,17 @@ int32_t RegMulReg(const Register& a, const Register& b, Register* res) {
   return 0;
 }
 
-int32_t RegDivReg(const Register& a, const Register& b, Register* res) {
+template <OperandKind kA, OperandKind kB>
+int32_t Div(const Register& a, const Register& b, Register* res) {
+  const DataType a_type = KindType(kA);
+  const DataType b_type = KindType(kB);
+  const bool a_unsigned = KindUnsigned(kA);
+  const bool b_unsigned = KindUnsigned(kB);
   DataType res_type = kTypeUnknown;
-  if (a.type == kTypeDouble || b.type == kTypeDouble) {
+  if (a_type == kTypeDouble || b_type == kTypeDouble) {
     res_type = kTypeDouble;
   } else {
-    assert(a.type == kTypeBigInt && b.type == kTypeBigInt);
+    assert(a_type == kTypeBigInt && b_type == kTypeBigInt);
     res_type = kTypeBigInt;
   }
 
@@ -440,20 +505,16 @@ int32_t RegDivReg(const Register& a, const Register& b, Register* res) {
     bool val0_negative, val1_negative, res_negative, res_unsigned;
     uint64_t uval0, uval1, res_val;
 
-    val0_negative = !a.is_unsigned && val0 < 0;
-    val1_negative = !b.is_unsigned && val1 < 0;
+    val0_negative = !a_unsigned && val0 < 0;
+    val1_negative = !b_unsigned && val1 < 0;
     res_negative = val0_negative != val1_negative;
     res_unsigned = !res_negative;
 
     if (val1 == 0) {
       // Divide by zero
-      if (res_unsigned) {
-        SetRegisterNull(res);
-      } else {
-        res->value.val_int64 = 0;
-      }
+      SetRegisterNull(res);
       res->type = res_type;
-      res->is_unsigned = res_unsigned;
+      return 1;
     }
 
     uval0 = static_cast<uint64_t>(val0_negative &&
@@ -472,10 +533,10 @@ int32_t RegDivReg(const Register& a, const Register& b, Register* res) {
     // Check if res_val is overflow
     bool unsigned_flag = false;
     if (res_type == kTypeBigInt) {
-      unsigned_flag = (a.is_unsigned | b.is_unsigned);
+      unsigned_flag = (a_unsigned | b_unsigned);
     } else {
       assert(res_type == kTypeDouble);
-      unsigned_flag = (a.is_unsigned & b.is_unsigned);
+      unsigned_flag = (a_unsigned & b_unsigned);
     }
     if ((unsigned_flag && !res_unsigned && res_val < 0) ||
         (!unsigned_flag && res_unsigned &&
@@ -491,14 +552,14 @@ int32_t RegDivReg(const Register& a, const Register& b, Register* res) {
     res->is_unsigned = unsigned_flag;
   } else {
     assert(res_type == kTypeDouble);
-    double val0 = (a.type == kTypeDouble) ?
+    double val0 = (a_type == kTypeDouble) ?
                      a.value.val_double :
-                     ((a.is_unsigned == true) ?
+                     ((a_unsigned == true) ?
                        static_cast<double>(a.value.val_uint64) :
                        static_cast<double>(a.value.val_int64));
-    double val1 = (b.type == kTypeDouble) ?
+    double val1 = (b_type == kTypeDouble) ?
                      b.value.val_double :
-                     ((b.is_unsigned == true) ?
+                     ((b_unsigned == true) ?
                        static_cast<double>(b.value.val_uint64) :
                        static_cast<double>(b.value.val_int64));
     if (val1 == 0) {
@@ -521,12 +582,17 @@ int32_t RegDivReg(const Register& a, const Register& b, Register* res) {
   return 0;
 }
 
-int32_t RegModReg(const Register& a, const Register& b, Register* res) {
+template <OperandKind kA, OperandKind kB>
+int32_t Mod(const Register& a, const Register& b, Register* res) {
+  const DataType a_type = KindType(kA);
+  const DataType b_type = KindType(kB);
+  const bool a_unsigned = KindUnsigned(kA);
+  const bool b_unsigned = KindUnsigned(kB);
   DataType res_type = kTypeUnknown;
-  if (a.type == kTypeDouble || b.type == kTypeDouble) {
+  if (a_type == kTypeDouble || b_type == kTypeDouble) {
     res_type = kTypeDouble;
   } else {
-    assert(a.type == kTypeBigInt && b.type == kTypeBigInt);
+    assert(a_type == kTypeBigInt && b_type == kTypeBigInt);
     res_type = kTypeBigInt;
   }
 
@@ -542,19 +608,15 @@ int32_t RegModReg(const Register& a, const Register& b, Register* res) {
     bool val0_negative, val1_negative, res_unsigned;
     uint64_t uval0, uval1, res_val;
 
-    val0_negative = !a.is_unsigned && val0 < 0;
-    val1_negative = !b.is_unsigned && val1 < 0;
+    val0_negative = !a_unsigned && val0 < 0;
+    val1_negative = !b_unsigned && val1 < 0;
     res_unsigned = !val0_negative;
 
     if (val1 == 0) {
       // Divide by zero
-      if (res_unsigned) {
-        res->value.val_uint64 = 0;
-      } else {
-        res->value.val_int64 = 0;
-      }
+      SetRegisterNull(res);
       res->type = res_type;
-      res->is_unsigned = res_unsigned;
+      return 1;
     }
 
     uval0 = static_cast<uint64_t>(val0_negative &&
@@ -567,10 +629,10 @@ int32_t RegModReg(const Register& a, const Register& b, Register* res) {
     // Check if res_val is overflow
     bool unsigned_flag = false;
     if (res_type == kTypeBigInt) {
-      unsigned_flag = (a.is_unsigned | b.is_unsigned);
+      unsigned_flag = (a_unsigned | b_unsigned);
     } else {
       assert(res_type == kTypeDouble);
-      unsigned_flag = (a.is_unsigned & b.is_unsigned);
+      unsigned_flag = (a_unsigned & b_unsigned);
     }
     if ((unsigned_flag && !res_unsigned && res_val < 0) ||
         (!unsigned_flag && res_unsigned &&
@@ -586,14 +648,14 @@ int32_t RegModReg(const Register& a, const Register& b, Register* res) {
     res->is_unsigned = unsigned_flag;
   } else {
     assert(res_type == kTypeDouble);
-    double val0 = (a.type == kTypeDouble) ?
+    double val0 = (a_type == kTypeDouble) ?
                      a.value.val_double :
-                     ((a.is_unsigned == true) ?
+                     ((a_unsigned == true) ?
                        static_cast<double>(a.value.val_uint64) :
                        static_cast<double>(a.value.val_int64));
-    double val1 = (b.type == kTypeDouble) ?
+    double val1 = (b_type == kTypeDouble) ?
                      b.value.val_double :
-                     ((b.is_unsigned == true) ?
+                     ((b_unsigned == true) ?
                        static_cast<double>(b.value.val_uint64) :
                        static_cast<double>(b.value.val_int64));
     if (val1 == 0) {
@@ -610,6 +672,93 @@ int32_t RegModReg(const Register& a, const Register& b, Register* res) {
   return 0;
 }
 
+#define ARITH_KERNELS(op)                                                 \
+  {{op<kKindInt64, kKindInt64>, op<kKindInt64, kKindUint64>,             \
+    op<kKindInt64, kKindDouble>},                                        \
+   {op<kKindUint64, kKindInt64>, op<kKindUint64, kKindUint64>,           \
+    op<kKindUint64, kKindDouble>},                                       \
+   {op<kKindDouble, kKindInt64>, op<kKindDouble, kKindUint64>,           \
+    op<kKindDouble, kKindDouble>}}
+
+const RegOpReg kPlusKernels[kKindTotal][kKindTotal] = ARITH_KERNELS(Plus);
+const RegOpReg kMinusKernels[kKindTotal][kKindTotal] = ARITH_KERNELS(Minus);
+const RegOpReg kMulKernels[kKindTotal][kKindTotal] = ARITH_KERNELS(Mul);
+const RegOpReg kDivKernels[kKindTotal][kKindTotal] = ARITH_KERNELS(Div);
+const RegOpReg kModKernels[kKindTotal][kKindTotal] = ARITH_KERNELS(Mod);
+
+#undef ARITH_KERNELS
+
+/*
+ * The kernel of arithmetic |op| specialized for operands of kinds a and b.
+ */
+RegOpReg GetArithKernel(uint8_t op, OperandKind a, OperandKind b) {
+  switch (op) {
+    case kOpPlus:
+      return kPlusKernels[a][b];
+    case kOpMinus:
+      return kMinusKernels[a][b];
+    case kOpMul:
+      return kMulKernels[a][b];
+    case kOpDiv:
+      return kDivKernels[a][b];
+    case kOpMod:
+      return kModKernels[a][b];
+    default:
+      assert(0);
+      return nullptr;
+  }
+}
+
+/*
+ * Kernels picking the specialization from the registers at runtime, for
+ * operands whose kinds are not known in Init().
+ */
+int32_t RegPlusReg(const Register& a, const Register& b, Register* res) {
+  return kPlusKernels[KindOf(a.type, a.is_unsigned)]
+                     [KindOf(b.type, b.is_unsigned)](a, b, res);
+}
+
+int32_t RegMinusReg(const Register& a, const Register& b, Register* res) {
+  return kMinusKernels[KindOf(a.type, a.is_unsigned)]
+                      [KindOf(b.type, b.is_unsigned)](a, b, res);
+}
+
+int32_t RegMulReg(const Register& a, const Register& b, Register* res) {
+  return kMulKernels[KindOf(a.type, a.is_unsigned)]
+                    [KindOf(b.type, b.is_unsigned)](a, b, res);
+}
+
+int32_t RegDivReg(const Register& a, const Register& b, Register* res) {
+  return kDivKernels[KindOf(a.type, a.is_unsigned)]
+                    [KindOf(b.type, b.is_unsigned)](a, b, res);
+}
+
+int32_t RegModReg(const Register& a, const Register& b, Register* res) {
+  return kModKernels[KindOf(a.type, a.is_unsigned)]
+                    [KindOf(b.type, b.is_unsigned)](a, b, res);
+}
+
+/*
+ * The kernel of arithmetic |op| for operands only known at runtime.
+ */
+RegOpReg GetArithKernel(uint8_t op) {
+  switch (op) {
+    case kOpPlus:
+      return RegPlusReg;
+    case kOpMinus:
+      return RegMinusReg;
+    case kOpMul:
+      return RegMulReg;
+    case kOpDiv:
+      return RegDivReg;
+    case kOpMod:
+      return RegModReg;
+    default:
+      assert(0);
+      return nullptr;
+  }
+}
+
 int32_t Min(const Register& a, AggResItem* res) {
   assert(res != nullptr && (a.is_null || a.type == res->type));
   // assert(res != nullptr && a.is_unsigned == res->is_unsigned);
@@ -861,13 +1010,62 @@ int32_t Sum(const Register& a, AggResItem* res) {
   return 0;
 }
 
-bool AggInterpreter::Init() {
+/*
+ * Type a group by column of |def| has in the key.
+ */
+inline GBColInfo KeyColInfo(const ColumnDef& def) {
+  if (def.type == kTypeVarchar) {
+    return {kTypeVarchar, false};
+  }
+  return {static_cast<ColumnType>(CeilType(def.type)), def.is_unsigned};
+}
+
+AggInterpreter::~AggInterpreter() {
+  delete[] opt_prog_;
+  delete[] gb_cols_;
+  delete[] agg_results_;
+  delete[] agg_ops_;
+  delete[] insts_;
+  delete[] vregisters_;
+  delete[] batch_aggs_;
+  delete[] batch_rows_;
+  delete[] batch_sel_;
+  delete[] spill_row_;
+  delete layout_;
+  delete[] gb_cols_info_;
+  delete[] key_buf_;
+  delete gb_table_;
+  delete spill_;
+  delete having_;
+  if (spill_run_) {
+    fclose(spill_run_);
+  }
+}
+
+bool AggInterpreter::Init(const ColumnDef* schema, uint32_t n_cols) {
   if (inited_) {
     return true;
   }
 
   uint32_t value = 0;
 
+  error_ = VerifyProgram(prog_, prog_len_, schema, n_cols);
+  if (error_ != kVerifyOk) {
+    return false;
+  }
+  schema_ = schema;
+  n_cols_ = n_cols;
+  layout_ = new RowLayout(schema, n_cols);
+
+  if (optimize_) {
+    opt_prog_ = new uint32_t[prog_len_];
+    uint32_t opt_len = OptimizeProgram(prog_, prog_len_, opt_prog_);
+    if (opt_len) {
+      prog_ = opt_prog_;
+      prog_len_ = opt_len;
+    }
+  }
+
   /*
    * 1. Double check the magic num and  total length of program.
    */
@@ -894,7 +1092,18 @@ bool AggInterpreter::Init() {
       gb_cols_[i++] = prog_[cur_pos_++];
     }
 
-    gb_map_ = new std::map<Entry, Entry, EntryCmp>;
+    gb_table_ = new GroupTable(n_agg_results_ * sizeof(AggResItem));
+    // A single integer key indexes its group directly once the keys are
+    // dense enough, or within the range hinted.
+    if (n_gb_cols_ == 1 &&
+        KeyColInfo(schema[gb_cols_[0]]).type == kTypeBigInt) {
+      if (has_key_range_) {
+        gb_table_->EnableDenseIndex(schema[gb_cols_[0]].is_unsigned,
+                                    key_range_min_, key_range_max_);
+      } else {
+        gb_table_->EnableDenseIndex(schema[gb_cols_[0]].is_unsigned);
+      }
+    }
   }
 
   /*
@@ -905,15 +1114,34 @@ bool AggInterpreter::Init() {
     uint32_t i = 0;
     while (i < n_agg_results_ && cur_pos_ < prog_len_) {
       agg_results_[i].type = prog_[cur_pos_++];
+      agg_results_[i].is_unsigned = false;
       agg_results_[i].inited = false;  // used by Min/Max
       agg_results_[i++].value.val_int64 = 0;
     }
   }
 
-  inited_ = true;
   agg_prog_start_pos_ = cur_pos_;
   memset(registers_, 0, sizeof(registers_));
 
+  if (having_prog_) {
+    having_ = new HavingFilter(having_prog_, having_prog_len_);
+    error_ = having_->Init(agg_results_, n_agg_results_);
+    if (error_ != kVerifyOk) {
+      return false;
+    }
+  }
+
+  /*
+   * 5. Decode the aggregation program once and bind every instruction to
+   *    its handler.
+   */
+  if (!Decode()) {
+    return false;
+  }
+  Fuse();
+  Execute(nullptr, nullptr);
+
+  inited_ = true;
   return true;
 }
 
@@ -922,6 +1150,7 @@ DataType CeilType(DataType type) {
     case kTypeTinyInt:
     case kTypeSmallInt:
     case kTypeMediumInt:
+    case kTypeInt:
     case kTypeBigInt:
       return kTypeBigInt;
     case kTypeFloat:
@@ -937,343 +1166,1819 @@ bool DecodeRawType(uint8_t type, DataType* res) {
   return type & 0x10;
 }
 
-bool AggInterpreter::ProcessRec(Record* rec) {
-  AggResItem* agg_res_ptr = nullptr;
+void DecodeInstruction(uint32_t value, Instruction* inst) {
+  DataType type;
+  memset(inst, 0, sizeof(Instruction));
+  inst->op = (value & 0xFC000000) >> 26;
+  inst->is_unsigned = DecodeRawType((value & 0x03E00000) >> 21, &type);
+  inst->type = type;
+  switch (inst->op) {
+    case kOpPlus:
+    case kOpMinus:
+    case kOpMul:
+    case kOpDiv:
+    case kOpMod:
+    case kOpMov:
+      inst->is_unsigned2 = DecodeRawType((value & 0x001F0000) >> 16, &type);
+      inst->type2 = type;
+      inst->reg = (value & 0x0000F000) >> 12;
+      inst->reg2 = (value & 0x00000F00) >> 8;
+      break;
+    case kOpLoadCol:
+    case kOpCount:
+    case kOpSum:
+    case kOpMax:
+    case kOpMin:
+      inst->reg = (value & 0x000F0000) >> 16;
+      inst->index = (value & 0x0000FFFF);
+      break;
+    default:
+      break;
+  }
+}
 
-  if (n_gb_cols_) {
-    uint32_t agg_rec_len = 0;
-    for (uint32_t i = 0; i < n_gb_cols_; i++) {
-      Column* col = rec->GetColumn(gb_cols_[i]);
-      agg_rec_len += col->encoded_length();
-    }
-    agg_rec_len += (n_agg_results_ * sizeof(AggResItem));
-    char* agg_rec = new char[agg_rec_len];
-    memset(agg_rec, 0, agg_rec_len);
-
-    uint32_t pos = 0;
-    for (uint32_t i = 0; i < n_gb_cols_; i++) {
-      Column* col = rec->GetColumn(gb_cols_[i]);
-      memcpy(agg_rec + pos, col->buf(), col->encoded_length());
-      pos += col->encoded_length();
-      if (!gb_cols_type_inited_) {
-        gb_cols_info_[i] = {col->type(), col->is_unsigned()};
-      }
-    }
-    gb_cols_type_inited_ = true;
-    Entry entry{agg_rec, pos};
-    auto iter = gb_map_->find(entry);
-    if (iter != gb_map_->end()) {
-      agg_res_ptr = reinterpret_cast<AggResItem*>(iter->second.ptr);
-      delete[] agg_rec;
-    } else {
-      gb_map_->insert(std::make_pair<Entry, Entry>(std::move(entry),
-          std::move(Entry{agg_rec + pos,
-            static_cast<uint32_t>(n_agg_results_ * sizeof(AggResItem))})));
-      n_groups_ = gb_map_->size();
-      agg_res_ptr = reinterpret_cast<AggResItem*>(agg_rec + pos);
+uint32_t EncodeInstruction(const Instruction& inst) {
+  uint32_t value = static_cast<uint32_t>(inst.op) << 26 |
+                   (inst.is_unsigned ? 0x10 : 0) << 21 |
+                   (inst.type & 0x0F) << 21;
+  switch (inst.op) {
+    case kOpPlus:
+    case kOpMinus:
+    case kOpMul:
+    case kOpDiv:
+    case kOpMod:
+    case kOpMov:
+      value |= (inst.is_unsigned2 ? 0x10 : 0) << 16 |
+               (inst.type2 & 0x0F) << 16 |
+               (inst.reg & 0x0F) << 12 |
+               (inst.reg2 & 0x0F) << 8;
+      break;
+    case kOpLoadCol:
+    case kOpCount:
+    case kOpSum:
+    case kOpMax:
+    case kOpMin:
+      value |= (inst.reg & 0x0F) << 16 | inst.index;
+      break;
+    default:
+      break;
+  }
+  return value;
+}
 
-      for (uint32_t i = 0; i < n_agg_results_; i++) {
-        agg_res_ptr[i].type = agg_results_[i].type;
-      }
+bool AggInterpreter::Decode() {
+  assert(agg_prog_start_pos_ <= prog_len_);
+  n_insts_ = prog_len_ - agg_prog_start_pos_;
+  // One extra slot for the terminating instruction.
+  insts_ = new Instruction[n_insts_ + 1];
+  for (uint32_t i = 0; i < n_insts_; i++) {
+    DecodeInstruction(prog_[agg_prog_start_pos_ + i], &insts_[i]);
+    if (insts_[i].op >= kOpSumCol) {
+      insts_[i].op = kOpUnknown;
+    }
+    // The column is widened as it's loaded, its own type is in the schema.
+    if (insts_[i].op == kOpLoadCol) {
+      insts_[i].type = CeilType(insts_[i].type);
+    }
+  }
+  memset(&insts_[n_insts_], 0, sizeof(Instruction));
+  insts_[n_insts_].op = kOpTotal;
+
+  // Merge() combines each agg result by the op computing it.
+  agg_ops_ = new uint8_t[n_agg_results_ + 1];
+  memset(agg_ops_, kOpUnknown, n_agg_results_ + 1);
+  for (uint32_t i = 0; i < n_insts_; i++) {
+    const Instruction& inst = insts_[i];
+    if (inst.op >= kOpSum && inst.op <= kOpCount &&
+        inst.index < n_agg_results_) {
+      uint8_t* agg_op = &agg_ops_[inst.index];
+      *agg_op = (*agg_op == kOpUnknown || *agg_op == inst.op) ?
+                inst.op : static_cast<uint8_t>(kOpTotal);
     }
-  } else {
-    agg_res_ptr = agg_results_;
   }
 
-  Column* col;
-  uint32_t value;
-  uint8_t raw_type;
-  DataType type;
-  bool is_unsigned;
-  uint32_t reg_index;
-
-  uint8_t raw_type2;
-  DataType type2;
-  bool is_unsigned2;
-  uint32_t reg_index2;
-
-  uint32_t agg_index;
-  uint32_t col_index;
-
-  uint32_t exec_pos = agg_prog_start_pos_;
-  while (exec_pos < prog_len_) {
-    value = prog_[exec_pos++];
-    uint8_t op = (value & 0xFC000000) >> 26;
-    int ret = 0;
-    switch (op) {
+  /*
+   * Follow the kind of value each register holds through the program and
+   * bind every arithmetic instruction to the kernel specialized for its
+   * operands. Operands not known here are resolved per row.
+   */
+  OperandKind kinds[kRegTotal];
+  bool known[kRegTotal];
+  memset(known, 0, sizeof(known));
+  for (uint32_t i = 0; i < n_insts_; i++) {
+    Instruction* inst = &insts_[i];
+    switch (inst->op) {
       case kOpPlus:
-        raw_type = (value & 0x03E00000) >> 21;
-        raw_type2 = (value & 0x001F0000) >> 16;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        is_unsigned2 = DecodeRawType(raw_type2, &type2);
-
-        reg_index = (value & 0x0000F000) >> 12;
-        reg_index2 = (value & 0x00000F00) >> 8;
-
-        assert(registers_[reg_index].type == kTypeBigInt ||
-              registers_[reg_index].type == kTypeDouble);
-        assert(registers_[reg_index2].type == kTypeBigInt ||
-              registers_[reg_index2].type == kTypeDouble);
-
-        ret = RegPlusReg(registers_[reg_index], registers_[reg_index2],
-                              &registers_[reg_index]);
-        if (ret < 0) {
-          printf("Overflow, value is out of range\n");
-        }
-        assert(ret >= 0);
-        break;
-
       case kOpMinus:
-        raw_type = (value & 0x03E00000) >> 21;
-        raw_type2 = (value & 0x001F0000) >> 16;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        is_unsigned2 = DecodeRawType(raw_type2, &type2);
-
-        reg_index = (value & 0x0000F000) >> 12;
-        reg_index2 = (value & 0x00000F00) >> 8;
-
-        assert(registers_[reg_index].type == kTypeBigInt ||
-              registers_[reg_index].type == kTypeDouble);
-        assert(registers_[reg_index2].type == kTypeBigInt ||
-              registers_[reg_index2].type == kTypeDouble);
-
-        ret = RegMinusReg(registers_[reg_index], registers_[reg_index2],
-                              &registers_[reg_index]);
-        if (ret < 0) {
-          printf("Overflow, value is out of range\n");
-        }
-        assert(ret >= 0);
-        break;
-
       case kOpMul:
-        raw_type = (value & 0x03E00000) >> 21;
-        raw_type2 = (value & 0x001F0000) >> 16;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        is_unsigned2 = DecodeRawType(raw_type2, &type2);
-
-        reg_index = (value & 0x0000F000) >> 12;
-        reg_index2 = (value & 0x00000F00) >> 8;
-
-        assert(registers_[reg_index].type == kTypeBigInt ||
-              registers_[reg_index].type == kTypeDouble);
-        assert(registers_[reg_index2].type == kTypeBigInt ||
-              registers_[reg_index2].type == kTypeDouble);
-
-        ret = RegMulReg(registers_[reg_index], registers_[reg_index2],
-                              &registers_[reg_index]);
-        if (ret < 0) {
-          printf("Overflow, value is out of range\n");
-        }
-        assert(ret >= 0);
-        break;
-
       case kOpDiv:
-        raw_type = (value & 0x03E00000) >> 21;
-        raw_type2 = (value & 0x001F0000) >> 16;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        is_unsigned2 = DecodeRawType(raw_type2, &type2);
-
-        reg_index = (value & 0x0000F000) >> 12;
-        reg_index2 = (value & 0x00000F00) >> 8;
-
-        assert(registers_[reg_index].type == kTypeBigInt ||
-              registers_[reg_index].type == kTypeDouble);
-        assert(registers_[reg_index2].type == kTypeBigInt ||
-              registers_[reg_index2].type == kTypeDouble);
-
-        ret = RegDivReg(registers_[reg_index], registers_[reg_index2],
-                              &registers_[reg_index]);
-        if (ret < 0) {
-          printf("Overflow, value is out of range\n");
-        }
-        assert(ret >= 0);
-        break;
-
       case kOpMod:
-        raw_type = (value & 0x03E00000) >> 21;
-        raw_type2 = (value & 0x001F0000) >> 16;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        is_unsigned2 = DecodeRawType(raw_type2, &type2);
-
-        reg_index = (value & 0x0000F000) >> 12;
-        reg_index2 = (value & 0x00000F00) >> 8;
-
-        assert(registers_[reg_index].type == kTypeBigInt ||
-              registers_[reg_index].type == kTypeDouble);
-        assert(registers_[reg_index2].type == kTypeBigInt ||
-              registers_[reg_index2].type == kTypeDouble);
-
-        ret = RegModReg(registers_[reg_index], registers_[reg_index2],
-                              &registers_[reg_index]);
-        if (ret < 0) {
-          printf("Overflow, value is out of range\n");
+        assert(inst->reg < kRegTotal && inst->reg2 < kRegTotal);
+        if (known[inst->reg] && known[inst->reg2]) {
+          inst->kernel = GetArithKernel(inst->op, kinds[inst->reg],
+                                        kinds[inst->reg2]);
+          kinds[inst->reg] = ResultKind(kinds[inst->reg], kinds[inst->reg2]);
+        } else {
+          inst->kernel = GetArithKernel(inst->op);
+          known[inst->reg] = false;
         }
-        assert(ret >= 0);
-
         break;
-
       case kOpLoadCol:
-        raw_type = (value & 0x03E00000) >> 21;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        reg_index = (value & 0x000F0000) >> 16;
-        col_index = (value & 0x0000FFFF);
-
-        col = rec->GetColumn(col_index);
-        assert(type == CeilType(col->type()) &&
-            col->raw_length() == sizeof(Register::value));
-
-        ResetRegister(&registers_[reg_index]);
-        registers_[reg_index].type = type;
-        registers_[reg_index].is_unsigned = is_unsigned;
-        // TODO(zhao song): registers_[reg_index].is_null = col->is_null();
-        registers_[reg_index].is_null = false;
-        switch (type) {
-          case kTypeBigInt:
-            registers_[reg_index].value.val_int64 = longlongget(col->data());
-            break;
-          case kTypeDouble:
-            registers_[reg_index].value.val_double = doubleget(col->data());
-          default:
-            break;
-        }
+        assert(inst->reg < kRegTotal);
+        kinds[inst->reg] = KindOf(inst->type, inst->is_unsigned);
+        known[inst->reg] = true;
         break;
-
-      case kOpCount:
-        raw_type = (value & 0x03E00000) >> 21;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        reg_index = (value & 0x000F0000) >> 16;
-        agg_index = (value & 0x0000FFFF);
-        assert(agg_results_[agg_index].type == kTypeUnknown ||
-               agg_results_[agg_index].type == kTypeBigInt);
-        ret = Count(registers_[reg_index], &agg_res_ptr[agg_index]);
-        if (ret < 0) {
-          printf("Overflow, value is out of range\n");
-        }
-        assert(ret >= 0);
+      case kOpMov:
+        assert(inst->reg < kRegTotal && inst->reg2 < kRegTotal);
+        kinds[inst->reg] = kinds[inst->reg2];
+        known[inst->reg] = known[inst->reg2];
+        break;
+      default:
         break;
+    }
+  }
+  return true;
+}
 
-       case kOpSum:
-        raw_type = (value & 0x03E00000) >> 21;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        reg_index = (value & 0x000F0000) >> 16;
-        agg_index = (value & 0x0000FFFF);
-        assert(type == agg_results_[agg_index].type);
+/*
+ * Registers read and written by a decoded instruction, as bit masks.
+ */
+void RegUseDef(const Instruction& inst, uint32_t* use, uint32_t* def) {
+  *use = 0;
+  *def = 0;
+  switch (inst.op) {
+    case kOpPlus:
+    case kOpMinus:
+    case kOpMul:
+    case kOpDiv:
+    case kOpMod:
+      *use = 1U << inst.reg | 1U << inst.reg2;
+      *def = 1U << inst.reg;
+      break;
+    case kOpMov:
+      *use = 1U << inst.reg2;
+      *def = 1U << inst.reg;
+      break;
+    case kOpLoadCol:
+      *def = 1U << inst.reg;
+      break;
+    case kOpCount:
+    case kOpSum:
+    case kOpMax:
+    case kOpMin:
+      *use = 1U << inst.reg;
+      break;
+    default:
+      break;
+  }
+}
 
-        ret = Sum(registers_[reg_index], &agg_res_ptr[agg_index]);
+/*
+ * Peephole pass folding
+ *   LOADCOL r, c; SUM r, k                     into SUMCOL c, k
+ *   LOADCOL r, c; COUNT r, k                   into COUNTCOL c, k
+ *   LOADCOL r, c; LOADCOL r2, c2; MUL r, r2; SUM r, k
+ *                                              into MULSUMCOLS c, c2, k
+ * as long as nothing reads the registers afterwards. A fused op reads the
+ * columns straight into a local it aggregates, one dispatch instead of 2-4.
+ */
+void AggInterpreter::Fuse() {
+  if (n_insts_ == 0) {
+    return;
+  }
+  /*
+   * Registers live after each instruction. Registers the program reads
+   * before writing keep their value into the next row, so they're live at
+   * the end too.
+   */
+  uint32_t* live_after = new uint32_t[n_insts_];
+  uint32_t exposed = 0;
+  uint32_t written = 0;
+  for (uint32_t i = 0; i < n_insts_; i++) {
+    uint32_t use, def;
+    RegUseDef(insts_[i], &use, &def);
+    exposed |= use & ~written;
+    written |= def;
+  }
+  uint32_t live = exposed;
+  for (uint32_t i = n_insts_; i-- > 0;) {
+    uint32_t use, def;
+    live_after[i] = live;
+    RegUseDef(insts_[i], &use, &def);
+    live = (live & ~def) | use;
+  }
 
-        if (ret < 0) {
-          printf("Overflow, value is out of range\n");
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < n_insts_; i++) {
+    const Instruction* inst = &insts_[i];
+    Instruction fused;
+    uint32_t len = 0;
+    if (inst->op == kOpLoadCol && i + 1 < n_insts_) {
+      const Instruction* next = &insts_[i + 1];
+      uint32_t reg = 1U << inst->reg;
+      if (next->op == kOpSum && next->reg == inst->reg &&
+          !(live_after[i + 1] & reg)) {
+        fused = *inst;
+        fused.op = kOpSumCol;
+        fused.agg = next->index;
+        len = 2;
+      } else if (next->op == kOpCount && next->reg == inst->reg &&
+                 !(live_after[i + 1] & reg)) {
+        fused = *inst;
+        fused.op = kOpCountCol;
+        fused.agg = next->index;
+        len = 2;
+      } else if (next->op == kOpLoadCol && next->reg != inst->reg &&
+                 i + 3 < n_insts_) {
+        const Instruction* mul = &insts_[i + 2];
+        const Instruction* sum = &insts_[i + 3];
+        uint32_t reg2 = 1U << next->reg;
+        if (mul->op == kOpMul && mul->reg == inst->reg &&
+            mul->reg2 == next->reg && sum->op == kOpSum &&
+            sum->reg == inst->reg && !(live_after[i + 2] & reg2) &&
+            !(live_after[i + 3] & reg)) {
+          fused = *inst;
+          fused.op = kOpMulSumCols;
+          fused.kernel = mul->kernel;
+          fused.type2 = next->type;
+          fused.is_unsigned2 = next->is_unsigned;
+          fused.index2 = next->index;
+          fused.agg = sum->index;
+          len = 4;
         }
-        assert(ret >= 0);
-        break;
+      }
+    }
+    if (len) {
+      insts_[n++] = fused;
+      i += len - 1;
+    } else {
+      insts_[n++] = *inst;
+    }
+  }
+  delete[] live_after;
 
-       case kOpMax:
-        raw_type = (value & 0x03E00000) >> 21;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        reg_index = (value & 0x000F0000) >> 16;
-        agg_index = (value & 0x0000FFFF);
-        assert(type == agg_results_[agg_index].type);
+  n_insts_ = n;
+  memset(&insts_[n_insts_], 0, sizeof(Instruction));
+  insts_[n_insts_].op = kOpTotal;
+}
 
-        ret = Max(registers_[reg_index], &agg_res_ptr[agg_index]);
+/*
+ * The value of |type| at |data| as the register it's loaded in holds it,
+ * see CeilType(). With a constant |type| the switch folds away.
+ */
+inline DataValue LoadValue(const unsigned char* data, ColumnType type,
+                           bool is_unsigned) {
+  const char* p = reinterpret_cast<const char*>(data);
+  DataValue value;
+  switch (type) {
+    case kTypeTinyInt:
+      value.val_int64 = is_unsigned ? static_cast<int64_t>(data[0]) :
+                        static_cast<int8_t>(data[0]);
+      break;
+    case kTypeSmallInt:
+      value.val_int64 = is_unsigned ? static_cast<int64_t>(uint2korr(p)) :
+                        sint2korr(p);
+      break;
+    case kTypeMediumInt:
+      value.val_int64 = is_unsigned ? static_cast<int64_t>(uint3korr(data)) :
+                        sint3korr(data);
+      break;
+    case kTypeInt:
+      value.val_int64 = is_unsigned ? static_cast<int64_t>(uint4korr(p)) :
+                        sint4korr(p);
+      break;
+    case kTypeFloat:
+      value.val_double = floatget(data);
+      break;
+    case kTypeDouble:
+      value.val_double = doubleget(data);
+      break;
+    default:
+      value.val_int64 = longlongget(data);
+      break;
+  }
+  return value;
+}
 
-        if (ret < 0) {
-          printf("Overflow, value is out of range\n");
-        }
-        assert(ret >= 0);
-        break;
+/*
+ * Whether row |r| of |col| is NULL.
+ */
+inline bool IsNullAt(const ColumnVector& col, uint32_t r) {
+  return col.validity && ((col.validity[r >> 3] >> (r & 7)) & 1) == 0;
+}
+
+/*
+ * Length of column |def| at |data| in a group key: the NULL flag, then the
+ * value unless |is_null|. Numbers are widened to 8 bytes, so keys don't
+ * depend on the width a column is stored in.
+ */
+inline uint32_t KeyLength(const unsigned char* data, const ColumnDef& def,
+                          bool is_null) {
+  if (is_null) {
+    return 1;
+  }
+  if (def.type != kTypeVarchar) {
+    return 1 + sizeof(int64_t);
+  }
+  uint32_t raw_len;
+  memcpy(&raw_len, data, sizeof(raw_len));
+  return 1 + sizeof(raw_len) + raw_len;
+}
 
-       case kOpMin:
-        raw_type = (value & 0x03E00000) >> 21;
-        is_unsigned = DecodeRawType(raw_type, &type);
-        reg_index = (value & 0x000F0000) >> 16;
-        agg_index = (value & 0x0000FFFF);
-        assert(type == agg_results_[agg_index].type);
+/*
+ * Same for column |col_id| of row |r| of |batch|.
+ */
+inline uint32_t KeyLength(const ColumnBatch& batch, const ColumnDef& def,
+                          uint16_t col_id, uint32_t r) {
+  if (IsNullAt(batch.cols[col_id], r)) {
+    return 1;
+  }
+  if (def.type != kTypeVarchar) {
+    return 1 + sizeof(int64_t);
+  }
+  const uint32_t* offsets = batch.cols[col_id].offsets;
+  // Flag, length, bytes and the NUL.
+  return 1 + sizeof(uint32_t) + offsets[r + 1] - offsets[r] + 1;
+}
 
-        ret = Min(registers_[reg_index], &agg_res_ptr[agg_index]);
+/*
+ * Writes column |def| at |data| into |buf| as a group key has it, in
+ * |len| bytes from KeyLength(), a single one for a NULL.
+ */
+inline void EncodeKey(const unsigned char* data, const ColumnDef& def,
+                      uint32_t len, char* buf) {
+  if (len == 1) {
+    buf[0] = kKeyNull;
+    return;
+  }
+  buf[0] = kKeyNotNull;
+  if (def.type == kTypeVarchar) {
+    memcpy(buf + 1, data, len - 1);
+    return;
+  }
+  DataValue value = LoadValue(data, def.type, def.is_unsigned);
+  memcpy(buf + 1, &value, sizeof(value));
+}
 
-        assert(ret >= 0);
-        break;
+/*
+ * Same for column |col_id| of row |r| of |batch|.
+ */
+inline void EncodeKey(const ColumnBatch& batch, const ColumnDef& def,
+                      uint16_t col_id, uint32_t r, uint32_t len, char* buf) {
+  const ColumnVector& col = batch.cols[col_id];
+  if (def.type != kTypeVarchar || len == 1) {
+    EncodeKey(col.data + static_cast<size_t>(r) * EncodedWidth(def), def,
+              len, buf);
+    return;
+  }
+  buf[0] = kKeyNotNull;
+  uint32_t raw_len = len - 1 - sizeof(raw_len);
+  memcpy(buf + 1, &raw_len, sizeof(raw_len));
+  memcpy(buf + 1 + sizeof(raw_len), col.data + col.offsets[r], raw_len - 1);
+  buf[len - 1] = '\0';
+}
 
-      default:
-        break;
-    }
+/*
+ * Writes column |col_id| of row |r| of |batch| into |buf| as an encoded row
+ * has it. Returns false if a VARCHAR is longer than the schema allows.
+ */
+inline bool EncodeColumn(const ColumnBatch& batch, const ColumnDef& def,
+                         uint16_t col_id, uint32_t r, unsigned char* buf) {
+  const ColumnVector& col = batch.cols[col_id];
+  if (def.type != kTypeVarchar) {
+    uint32_t width = EncodedWidth(def);
+    memcpy(buf, col.data + static_cast<size_t>(r) * width, width);
+    return true;
   }
+  // Bytes and the NUL.
+  uint32_t raw_len = col.offsets[r + 1] - col.offsets[r] + 1;
+  if (raw_len > def.length) {
+    return false;
+  }
+  memcpy(buf, &raw_len, sizeof(raw_len));
+  memcpy(buf + sizeof(raw_len), col.data + col.offsets[r], raw_len - 1);
+  buf[sizeof(raw_len) + raw_len - 1] = '\0';
   return true;
 }
 
-void AggInterpreter::Print() {
-  if (n_gb_cols_) {
-    if (gb_map_) {
-      printf("Group by columns: [");
-      for (int i = 0; i < n_gb_cols_; i++) {
-        if (i != n_gb_cols_ - 1) {
-          printf("%u ", gb_cols_[i]);
-        } else {
-          printf("%u", gb_cols_[i]);
-        }
-      }
-      printf("]\n");
-      printf("Num of groups: %lu\n", gb_map_->size());
-      printf("Aggregation results:\n");
+/*
+ * Sets |items| to the aggregation results of the group whose key is the
+ * first |key_len| bytes of key_buf_, creating it on first sight, or to
+ * nullptr if it's not in memory and its rows have to be spilled.
+ */
+void AggInterpreter::FindGroup(uint32_t key_len, AggResItem** items) {
+  // Past the last level the budget is ignored rather than spill forever.
+  if (spill_ == nullptr && mem_budget_ &&
+      spill_level_ < SpillPartitions::kMaxLevel &&
+      gb_table_->memory_usage() + gb_table_->insert_cost() > mem_budget_) {
+    spill_ = new SpillPartitions(spill_level_, layout_->length());
+  }
+  if (spill_) {
+    // Table is full, only its groups are still aggregated in place.
+    *items = reinterpret_cast<AggResItem*>(gb_table_->Find(key_buf_,
+                                                           key_len));
+    return;
+  }
 
-      for (auto iter = gb_map_->begin(); iter != gb_map_->end(); iter++) {
-        int pos = 0;
-        printf("(");
-        for (int i = 0; i < n_gb_cols_; i++) {
-          if (gb_cols_info_[i].type == kTypeBigInt) {
-            if (gb_cols_info_[i].is_unsigned) {
-              if (i != n_gb_cols_ - 1) {
-                printf("%15lu, ", *(uint64_t*)(iter->first.ptr + pos));
-              } else {
-                printf("%15lu): ", *(uint64_t*)(iter->first.ptr + pos));
-              }
-            } else {
-              if (i != n_gb_cols_ - 1) {
-                printf("%15ld, ", *(int64_t*)(iter->first.ptr + pos));
-              } else {
-                printf("%15ld): ", *(int64_t*)(iter->first.ptr + pos));
-              }
-            }
-            pos += sizeof(int64_t);
-          } else if (gb_cols_info_[i].type == kTypeDouble) {
-            if (i != n_gb_cols_ - 1) {
-              printf("%.16f, ", *(double*)(iter->first.ptr + pos));
-            } else {
-              printf("%.16f): ", *(double*)(iter->first.ptr + pos));
-            }
-            pos += sizeof(double);
-          } else {
-            assert(gb_cols_info_[i].type == kTypeVarchar);
-            uint32_t len = *(uint32_t*)(iter->first.ptr + pos);
-            pos += sizeof(uint32_t);
-            if (i != n_gb_cols_ - 1) {
-              printf("%15s, ", (iter->first.ptr + pos));
-            } else {
-              printf("%15s): ", (iter->first.ptr + pos));
-            }
-          }
+  bool inserted = false;
+  *items = reinterpret_cast<AggResItem*>(
+      gb_table_->FindOrInsert(key_buf_, key_len, &inserted));
+  if (inserted) {
+    n_groups_ = gb_table_->size();
+
+    for (uint32_t i = 0; i < n_agg_results_; i++) {
+      (*items)[i].type = agg_results_[i].type;
+    }
+  }
+}
+
+/*
+ * Sets |items| to the aggregation results the program updates for |row|,
+ * creating its group on first sight, or to nullptr if the row is spilled
+ * instead. Returns false if spilling fails.
+ */
+bool AggInterpreter::GetAggResItems(const unsigned char* row,
+                                    AggResItem** items) {
+  if (n_gb_cols_ == 0) {
+    *items = agg_results_;
+    return true;
+  }
+
+  uint32_t key_len = 0;
+  for (uint32_t i = 0; i < n_gb_cols_; i++) {
+    key_len += KeyLength(row + layout_->offset(gb_cols_[i]),
+                         schema_[gb_cols_[i]],
+                         layout_->IsNull(row, gb_cols_[i]));
+  }
+  if (key_len > key_buf_len_) {
+    delete[] key_buf_;
+    key_buf_len_ = key_len * 2;
+    key_buf_ = new char[key_buf_len_];
+  }
+
+  uint32_t pos = 0;
+  for (uint32_t i = 0; i < n_gb_cols_; i++) {
+    const ColumnDef& def = schema_[gb_cols_[i]];
+    const unsigned char* data = row + layout_->offset(gb_cols_[i]);
+    uint32_t len = KeyLength(data, def, layout_->IsNull(row, gb_cols_[i]));
+    EncodeKey(data, def, len, key_buf_ + pos);
+    pos += len;
+    if (!gb_cols_type_inited_) {
+      gb_cols_info_[i] = KeyColInfo(def);
+    }
+  }
+  gb_cols_type_inited_ = true;
+
+  FindGroup(pos, items);
+  return *items != nullptr || spill_->Add(key_buf_, pos, row);
+}
+
+/*
+ * Same for row |r| of |batch|. A spilled row is encoded as ProcessRows()
+ * takes it.
+ */
+bool AggInterpreter::GetAggResItems(const ColumnBatch& batch, uint32_t r,
+                                    AggResItem** items) {
+  if (n_gb_cols_ == 0) {
+    *items = agg_results_;
+    return true;
+  }
+
+  uint32_t key_len = 0;
+  for (uint32_t i = 0; i < n_gb_cols_; i++) {
+    key_len += KeyLength(batch, schema_[gb_cols_[i]], gb_cols_[i], r);
+  }
+  if (key_len > key_buf_len_) {
+    delete[] key_buf_;
+    key_buf_len_ = key_len * 2;
+    key_buf_ = new char[key_buf_len_];
+  }
+
+  uint32_t pos = 0;
+  for (uint32_t i = 0; i < n_gb_cols_; i++) {
+    const ColumnDef& def = schema_[gb_cols_[i]];
+    uint32_t len = KeyLength(batch, def, gb_cols_[i], r);
+    EncodeKey(batch, def, gb_cols_[i], r, len, key_buf_ + pos);
+    pos += len;
+    if (!gb_cols_type_inited_) {
+      gb_cols_info_[i] = KeyColInfo(def);
+    }
+  }
+  gb_cols_type_inited_ = true;
+
+  FindGroup(pos, items);
+  if (*items != nullptr) {
+    return true;
+  }
+  if (spill_row_ == nullptr) {
+    spill_row_ = new unsigned char[layout_->length()];
+  }
+  layout_->Clear(spill_row_);
+  for (uint16_t c = 0; c < n_cols_; c++) {
+    if (!EncodeColumn(batch, schema_[c], c, r,
+                      spill_row_ + layout_->offset(c))) {
+      return false;
+    }
+    if (IsNullAt(batch.cols[c], r)) {
+      layout_->SetNull(spill_row_, c);
+    }
+  }
+  return spill_->Add(key_buf_, pos, spill_row_);
+}
+
+/*
+ * A row whose group is spilled gets no items, it's aggregated later on.
+ */
+bool AggInterpreter::ProcessRec(Record* rec) {
+  const unsigned char* row = rec->buf();
+  AggResItem* items = nullptr;
+  if (!GetAggResItems(row, &items)) {
+    return false;
+  }
+  return items == nullptr || Execute(row, items);
+}
+
+/*
+ * Loads column |col_id| of |row| into |reg| of its CeilType() |type|.
+ */
+inline void LoadRegister(const unsigned char* row, const RowLayout& layout,
+                         uint16_t col_id, uint8_t type, bool is_unsigned,
+                         Register* reg) {
+  ResetRegister(reg);
+  reg->type = type;
+  reg->is_unsigned = is_unsigned;
+  reg->is_null = layout.IsNull(row, col_id);
+  reg->value = LoadValue(row + layout.offset(col_id), layout.def(col_id).type,
+                         is_unsigned);
+}
+
+/*
+ * Threaded dispatch: with GCC/Clang every handler jumps straight to the
+ * handler of the next instruction through the label address bound in Init(),
+ * otherwise fall back to a switch over the decoded op.
+ */
+#if defined(__GNUC__)
+#define AGG_COMPUTED_GOTO 1
+#else
+#define AGG_COMPUTED_GOTO 0
+#endif
+
+#if AGG_COMPUTED_GOTO
+#define TARGET(op) target_##op:
+#define DISPATCH() do { inst = pc++; goto *inst->handler; } while (0)
+#else
+#define TARGET(op) case op:
+#define DISPATCH() continue
+#endif
+
+/*
+ * Runs the decoded program against |row|. Init() calls it with row == nullptr
+ * once to resolve the handler of every decoded instruction.
+ */
+bool AggInterpreter::Execute(const unsigned char* row,
+                             AggResItem* agg_res_ptr) {
+#if AGG_COMPUTED_GOTO
+  static const void* const dispatch_table[kOpTotal + 1] = {
+    &&target_kOpUnknown,
+    &&target_kOpPlus,
+    &&target_kOpMinus,
+    &&target_kOpMul,
+    &&target_kOpDiv,
+    &&target_kOpMod,
+    &&target_kOpLoadCol,
+    &&target_kOpStore,
+    &&target_kOpSum,
+    &&target_kOpMax,
+    &&target_kOpMin,
+    &&target_kOpCount,
+    &&target_kOpMov,
+    &&target_kOpSumCol,
+    &&target_kOpCountCol,
+    &&target_kOpMulSumCols,
+    &&target_kOpTotal
+  };
+#endif
+
+  if (row == nullptr) {
+#if AGG_COMPUTED_GOTO
+    for (uint32_t i = 0; i <= n_insts_; i++) {
+      insts_[i].handler = dispatch_table[insts_[i].op];
+    }
+#endif
+    return true;
+  }
+
+  Register* regs = registers_;
+  const Instruction* pc = insts_;
+  const Instruction* inst;
+  int ret = 0;
+
+#if AGG_COMPUTED_GOTO
+  DISPATCH();
+#else
+  for (;;) {
+    inst = pc++;
+    switch (inst->op) {
+#endif
+
+      TARGET(kOpPlus)
+      TARGET(kOpMinus)
+      TARGET(kOpMul)
+      TARGET(kOpDiv)
+      TARGET(kOpMod) {
+        ret = inst->kernel(regs[inst->reg], regs[inst->reg2],
+                           &regs[inst->reg]);
+        if (ret < 0) {
+          printf("Overflow, value is out of range\n");
         }
+        assert(ret >= 0);
+        DISPATCH();
+      }
 
-        AggResItem* item = reinterpret_cast<AggResItem*>(iter->second.ptr);
-        for (int i = 0; i < n_agg_results_; i++) {
-          switch (item[i].type) {
-            case kTypeBigInt:
-              // printf("    (kTypeBigInt: %ld)\n", item[i].value.val_int64);
-              printf("[%15ld]", item[i].value.val_int64);
-              break;
-
-            case kTypeDouble:
-              // printf("    (kTypeDouble: %.16f)\n", item[i].value.val_double);
-              printf("[%31.16f]", item[i].value.val_double);
-              break;
-            default:
-              assert(0);
-          }
+      TARGET(kOpLoadCol) {
+        LoadRegister(row, *layout_, inst->index, inst->type,
+                     inst->is_unsigned, &regs[inst->reg]);
+        DISPATCH();
+      }
+
+      TARGET(kOpCount) {
+        ret = Count(regs[inst->reg], &agg_res_ptr[inst->index]);
+        if (ret < 0) {
+          printf("Overflow, value is out of range\n");
+        }
+        assert(ret >= 0);
+        DISPATCH();
+      }
+
+      TARGET(kOpSum) {
+        ret = Sum(regs[inst->reg], &agg_res_ptr[inst->index]);
+
+        if (ret < 0) {
+          printf("Overflow, value is out of range\n");
+        }
+        assert(ret >= 0);
+        DISPATCH();
+      }
+
+      TARGET(kOpMax) {
+        ret = Max(regs[inst->reg], &agg_res_ptr[inst->index]);
+
+        if (ret < 0) {
+          printf("Overflow, value is out of range\n");
+        }
+        assert(ret >= 0);
+        DISPATCH();
+      }
+
+      TARGET(kOpMin) {
+        ret = Min(regs[inst->reg], &agg_res_ptr[inst->index]);
+
+        assert(ret >= 0);
+        DISPATCH();
+      }
+
+      TARGET(kOpMov) {
+        regs[inst->reg] = regs[inst->reg2];
+        DISPATCH();
+      }
+
+      TARGET(kOpSumCol) {
+        Register val;
+        LoadRegister(row, *layout_, inst->index, inst->type,
+                     inst->is_unsigned, &val);
+        ret = Sum(val, &agg_res_ptr[inst->agg]);
+        if (ret < 0) {
+          printf("Overflow, value is out of range\n");
+        }
+        assert(ret >= 0);
+        DISPATCH();
+      }
+
+      TARGET(kOpCountCol) {
+        Register val;
+        LoadRegister(row, *layout_, inst->index, inst->type,
+                     inst->is_unsigned, &val);
+        ret = Count(val, &agg_res_ptr[inst->agg]);
+        if (ret < 0) {
+          printf("Overflow, value is out of range\n");
+        }
+        assert(ret >= 0);
+        DISPATCH();
+      }
+
+      TARGET(kOpMulSumCols) {
+        Register val;
+        Register val2;
+        LoadRegister(row, *layout_, inst->index, inst->type,
+                     inst->is_unsigned, &val);
+        LoadRegister(row, *layout_, inst->index2, inst->type2,
+                     inst->is_unsigned2, &val2);
+        ret = inst->kernel(val, val2, &val);
+        if (ret >= 0) {
+          ret = Sum(val, &agg_res_ptr[inst->agg]);
+        }
+        if (ret < 0) {
+          printf("Overflow, value is out of range\n");
+        }
+        assert(ret >= 0);
+        DISPATCH();
+      }
+
+      TARGET(kOpUnknown)
+      TARGET(kOpStore) {
+        DISPATCH();
+      }
+
+      TARGET(kOpTotal) {
+        return true;
+      }
+
+#if !AGG_COMPUTED_GOTO
+      default:
+        DISPATCH();
+    }
+  }
+#endif
+}
+
+#undef TARGET
+#undef DISPATCH
+
+typedef int32_t (*AggOpReg)(const Register& a, AggResItem* res);
+
+inline void GetLane(const VectorRegister& vreg, uint32_t i, Register* reg) {
+  reg->type = vreg.type;
+  reg->value = vreg.value[i];
+  reg->is_unsigned = vreg.is_unsigned[i];
+  reg->is_null = vreg.is_null[i];
+}
+
+inline void SetLane(const Register& reg, uint32_t i, VectorRegister* vreg) {
+  vreg->value[i] = reg.value;
+  vreg->is_unsigned[i] = reg.is_unsigned;
+  vreg->is_null[i] = reg.is_null;
+}
+
+/*
+ * ORs the NULL flags 8 lanes at a time.
+ */
+bool HasNull(const VectorRegister& vreg, uint32_t n) {
+  uint64_t any = 0;
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    memcpy(&word, vreg.is_null + i, sizeof(word));
+    any |= word;
+  }
+  for (; i < n; i++) {
+    any |= vreg.is_null[i];
+  }
+  return any != 0;
+}
+
+/*
+ * Converts the first n values of |vreg| to double the same way the scalar
+ * kernels do.
+ */
+void LanesToDouble(const VectorRegister& vreg, uint32_t n, double* out) {
+  if (vreg.type == kTypeDouble) {
+    for (uint32_t i = 0; i < n; i++) {
+      out[i] = vreg.value[i].val_double;
+    }
+  } else {
+    for (uint32_t i = 0; i < n; i++) {
+      out[i] = vreg.is_unsigned[i] ?
+                 static_cast<double>(vreg.value[i].val_uint64) :
+                 static_cast<double>(vreg.value[i].val_int64);
+    }
+  }
+}
+
+/*
+ * Generic path, runs the scalar kernel lane by lane. a = a op b.
+ */
+int32_t VecRegOpReg(RegOpReg kernel, VectorRegister* a,
+                    const VectorRegister& b, uint32_t n) {
+  Register ra, rb, res;
+  DataType res_type = kTypeUnknown;
+  for (uint32_t i = 0; i < n; i++) {
+    GetLane(*a, i, &ra);
+    GetLane(b, i, &rb);
+    res = ra;
+    if (kernel(ra, rb, &res) < 0) {
+      return -1;
+    }
+    SetLane(res, i, a);
+    if (!res.is_null) {
+      res_type = res.type;
+    }
+  }
+  if (res_type != kTypeUnknown) {
+    a->type = res_type;
+  }
+  return 0;
+}
+
+/*
+ * Fast path for +, -, * and / with a DOUBLE result. a = a op b on all
+ * lanes, then the lanes with a NULL operand are NULL, 0 and signed, as the
+ * scalar kernels leave them.
+ */
+int32_t VecDoubleOp(uint8_t op, VectorRegister* a, const VectorRegister& b,
+                    uint32_t n) {
+  double vb[kBatchSize];
+  bool is_null[kBatchSize];
+  double* res = reinterpret_cast<double*>(a->value);
+  static_assert(sizeof(DataValue) == sizeof(double),
+                "DataValue must be a plain 8-byte union");
+
+  for (uint32_t i = 0; i < n; i++) {
+    is_null[i] = a->is_null[i] | b.is_null[i];
+  }
+  LanesToDouble(*a, n, res);
+  LanesToDouble(b, n, vb);
+  switch (op) {
+    case kOpPlus:
+      for (uint32_t i = 0; i < n; i++) {
+        res[i] = res[i] + vb[i];
+      }
+      memset(a->is_unsigned, 0, n);
+      break;
+    case kOpMinus:
+      for (uint32_t i = 0; i < n; i++) {
+        res[i] = res[i] - vb[i];
+      }
+      break;
+    case kOpMul:
+      for (uint32_t i = 0; i < n; i++) {
+        res[i] = res[i] * vb[i];
+      }
+      break;
+    case kOpDiv:
+      for (uint32_t i = 0; i < n; i++) {
+        // Divided by zero
+        is_null[i] |= (vb[i] == 0);
+      }
+      for (uint32_t i = 0; i < n; i++) {
+        res[i] = is_null[i] ? 0 : res[i] / vb[i];
+      }
+      break;
+    default:
+      assert(0);
+  }
+  a->type = kTypeDouble;
+  for (uint32_t i = 0; i < n; i++) {
+    res[i] = is_null[i] ? 0 : res[i];
+    a->is_unsigned[i] &= !is_null[i];
+  }
+  memcpy(a->is_null, is_null, n);
+
+  bool finite = true;
+  for (uint32_t i = 0; i < n; i++) {
+    finite &= std::isfinite(res[i]);
+  }
+  if (!finite) {
+    // overflow
+    return -1;
+  }
+  return 0;
+}
+
+int32_t VecArith(const Instruction& inst, VectorRegister* a,
+                 const VectorRegister& b, uint32_t n) {
+  if (inst.op != kOpMod &&
+      (a->type == kTypeDouble || b.type == kTypeDouble)) {
+    return VecDoubleOp(inst.op, a, b, n);
+  }
+  return VecRegOpReg(inst.kernel, a, b, n);
+}
+
+/*
+ * Folds lane i of |a| into aggs[i][agg_index] for every row of the batch.
+ */
+int32_t VecAgg(AggOpReg kernel, const VectorRegister& a,
+               AggResItem* const* aggs, uint32_t agg_index, uint32_t n) {
+  Register ra;
+  for (uint32_t i = 0; i < n; i++) {
+    GetLane(a, i, &ra);
+    if (kernel(ra, &aggs[i][agg_index]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Without GROUP BY all rows of the batch fold into the same |res|, so the
+ * register is handed to the SIMD run kernels in one call.
+ */
+int32_t VecAggRun(uint8_t op, const VectorRegister& a, AggResItem* res,
+                  uint32_t n) {
+  // The run kernels skip the NULL checks when there is none.
+  const bool* is_null = HasNull(a, n) ? a.is_null : nullptr;
+  if (op == kOpCount) {
+    return CountRun(is_null, n, res);
+  }
+  if (a.type == kTypeDouble) {
+    const double* vals = reinterpret_cast<const double*>(a.value);
+    switch (op) {
+      case kOpSum:
+        return SumDoubleRun(vals, is_null, n, res);
+      case kOpMax:
+        return MaxDoubleRun(vals, is_null, n, res);
+      case kOpMin:
+        return MinDoubleRun(vals, is_null, n, res);
+      default:
+        assert(0);
+    }
+  }
+
+  // The sign of NULL lanes doesn't matter.
+  uint32_t n_valid = 0;
+  uint32_t n_unsigned = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    n_valid += !a.is_null[i];
+    n_unsigned += a.is_unsigned[i] & !a.is_null[i];
+  }
+  bool is_unsigned = n_unsigned != 0;
+  bool same_sign = n_unsigned == 0 || n_unsigned == n_valid;
+  AggOpReg kernel = (op == kOpSum) ? Sum : ((op == kOpMax) ? Max : Min);
+  if (a.type != kTypeBigInt || !same_sign) {
+    Register ra;
+    for (uint32_t i = 0; i < n; i++) {
+      GetLane(a, i, &ra);
+      if (kernel(ra, res) < 0) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+  if (is_unsigned) {
+    const uint64_t* vals = reinterpret_cast<const uint64_t*>(a.value);
+    switch (op) {
+      case kOpSum:
+        return SumUint64Run(vals, is_null, n, res);
+      case kOpMax:
+        return MaxUint64Run(vals, is_null, n, res);
+      default:
+        return MinUint64Run(vals, is_null, n, res);
+    }
+  } else {
+    const int64_t* vals = reinterpret_cast<const int64_t*>(a.value);
+    switch (op) {
+      case kOpSum:
+        return SumInt64Run(vals, is_null, n, res);
+      case kOpMax:
+        return MaxInt64Run(vals, is_null, n, res);
+      default:
+        return MinInt64Run(vals, is_null, n, res);
+    }
+  }
+}
+
+/*
+ * Widens the values of column |col_id| of the batch into |value|. The
+ * storage type is a template argument, so every loop is specialized for it.
+ */
+template <ColumnType kType>
+void WidenColumn(const BatchSource& src, const RowLayout& layout,
+                 uint16_t col_id, bool is_unsigned, uint32_t n,
+                 DataValue* value) {
+  if (src.cols) {
+    const size_t width = EncodedWidth(layout.def(col_id));
+    const unsigned char* data = src.cols->cols[col_id].data;
+    if (src.sel == nullptr) {
+      data += src.start * width;
+      for (uint32_t i = 0; i < n; i++) {
+        value[i] = LoadValue(data + i * width, kType, is_unsigned);
+      }
+    } else {
+      for (uint32_t i = 0; i < n; i++) {
+        value[i] = LoadValue(data + src.sel[i] * width, kType, is_unsigned);
+      }
+    }
+    return;
+  }
+  const uint32_t offset = layout.offset(col_id);
+  for (uint32_t i = 0; i < n; i++) {
+    value[i] = LoadValue(src.rows[i] + offset, kType, is_unsigned);
+  }
+}
+
+/*
+ * Loads column inst.index of the batch into |vreg|, widened to the
+ * register type. The NULL flags come from the validity bits with shifts
+ * and masks, there's no branch per row.
+ */
+void LoadColumn(const BatchSource& src, const RowLayout& layout, uint32_t n,
+                const Instruction& inst, VectorRegister* vreg) {
+  const ColumnType type = layout.def(inst.index).type;
+  vreg->type = inst.type;
+  memset(vreg->is_unsigned, inst.is_unsigned, n);
+  switch (type) {
+    case kTypeTinyInt:
+      WidenColumn<kTypeTinyInt>(src, layout, inst.index, inst.is_unsigned, n,
+                                vreg->value);
+      break;
+    case kTypeSmallInt:
+      WidenColumn<kTypeSmallInt>(src, layout, inst.index, inst.is_unsigned,
+                                 n, vreg->value);
+      break;
+    case kTypeMediumInt:
+      WidenColumn<kTypeMediumInt>(src, layout, inst.index, inst.is_unsigned,
+                                  n, vreg->value);
+      break;
+    case kTypeInt:
+      WidenColumn<kTypeInt>(src, layout, inst.index, inst.is_unsigned, n,
+                            vreg->value);
+      break;
+    case kTypeFloat:
+      WidenColumn<kTypeFloat>(src, layout, inst.index, inst.is_unsigned, n,
+                              vreg->value);
+      break;
+    case kTypeBigInt:
+    case kTypeDouble:
+      if (src.cols && src.sel == nullptr) {
+        // Both types are 8 bytes as in a DataValue.
+        memcpy(vreg->value, src.cols->cols[inst.index].data +
+               static_cast<size_t>(src.start) * sizeof(DataValue),
+               n * sizeof(DataValue));
+      } else if (type == kTypeBigInt) {
+        WidenColumn<kTypeBigInt>(src, layout, inst.index, inst.is_unsigned,
+                                 n, vreg->value);
+      } else {
+        WidenColumn<kTypeDouble>(src, layout, inst.index, inst.is_unsigned,
+                                 n, vreg->value);
+      }
+      break;
+    default:
+      memset(vreg->is_null, 0, n);
+      return;
+  }
+
+  if (src.cols == nullptr) {
+    for (uint32_t i = 0; i < n; i++) {
+      vreg->is_null[i] = layout.IsNull(src.rows[i], inst.index);
+    }
+    return;
+  }
+  const uint8_t* validity = src.cols->cols[inst.index].validity;
+  if (validity == nullptr) {
+    memset(vreg->is_null, 0, n);
+  } else if (src.sel == nullptr) {
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t r = src.start + i;
+      vreg->is_null[i] = ((validity[r >> 3] >> (r & 7)) & 1) ^ 1;
+    }
+  } else {
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t r = src.sel[i];
+      vreg->is_null[i] = ((validity[r >> 3] >> (r & 7)) & 1) ^ 1;
+    }
+  }
+}
+
+void AggInterpreter::InitBatch() {
+  assert(inited_);
+  if (vregisters_ == nullptr) {
+    // 2 more scratch registers for the fused ops.
+    vregisters_ = new VectorRegister[kRegTotal + 2];
+    batch_aggs_ = new AggResItem*[kBatchSize];
+    batch_rows_ = new const unsigned char*[kBatchSize];
+    batch_sel_ = new uint32_t[kBatchSize];
+  }
+}
+
+bool AggInterpreter::ProcessBatch(Record* const* recs, uint32_t n) {
+  InitBatch();
+  for (uint32_t start = 0; start < n; start += kBatchSize) {
+    uint32_t len = (n - start) < kBatchSize ? (n - start) : kBatchSize;
+    for (uint32_t i = 0; i < len; i++) {
+      batch_rows_[i] = recs[start + i]->buf();
+    }
+    BatchSource src = {batch_rows_, nullptr, 0, nullptr};
+    if (!ExecuteBatch(src, len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AggInterpreter::ProcessRows(const unsigned char* rows, uint32_t n) {
+  InitBatch();
+  for (uint32_t start = 0; start < n; start += kBatchSize) {
+    uint32_t len = (n - start) < kBatchSize ? (n - start) : kBatchSize;
+    const unsigned char* row = rows +
+        static_cast<size_t>(start) * layout_->length();
+    for (uint32_t i = 0; i < len; i++) {
+      batch_rows_[i] = row;
+      row += layout_->length();
+    }
+    BatchSource src = {batch_rows_, nullptr, 0, nullptr};
+    if (!ExecuteBatch(src, len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AggInterpreter::ProcessColumns(const ColumnBatch& batch) {
+  InitBatch();
+  if (batch.n_cols != n_cols_) {
+    return false;
+  }
+  for (uint32_t start = 0; start < batch.n_rows; start += kBatchSize) {
+    uint32_t len = (batch.n_rows - start) < kBatchSize ?
+                   (batch.n_rows - start) : kBatchSize;
+    BatchSource src = {nullptr, &batch, start, nullptr};
+    if (!ExecuteBatch(src, len)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * src.rows may be batch_rows_ itself, the spilled rows are dropped in
+ * place.
+ */
+bool AggInterpreter::ExecuteBatch(BatchSource src, uint32_t n) {
+  VectorRegister* vregs = vregisters_;
+
+  if (spill_ == nullptr && mem_budget_ == 0) {
+    if (src.rows) {
+      for (uint32_t i = 0; i < n; i++) {
+        GetAggResItems(src.rows[i], &batch_aggs_[i]);
+      }
+    } else {
+      for (uint32_t i = 0; i < n; i++) {
+        GetAggResItems(*src.cols, src.start + i, &batch_aggs_[i]);
+      }
+    }
+  } else {
+    // Leave the spilled rows out of the batch.
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      if (src.rows) {
+        const unsigned char* row = src.rows[i];
+        if (!GetAggResItems(row, &batch_aggs_[kept])) {
+          return false;
         }
-        printf("\n");
+        if (batch_aggs_[kept]) {
+          batch_rows_[kept++] = row;
+        }
+      } else {
+        uint32_t r = src.start + i;
+        if (!GetAggResItems(*src.cols, r, &batch_aggs_[kept])) {
+          return false;
+        }
+        if (batch_aggs_[kept]) {
+          batch_sel_[kept++] = r;
+        }
+      }
+    }
+    if (src.rows) {
+      src.rows = batch_rows_;
+    } else {
+      src.sel = batch_sel_;
+    }
+    n = kept;
+    if (n == 0) {
+      return true;
+    }
+  }
+
+  for (uint32_t pc = 0; pc < n_insts_; pc++) {
+    const Instruction& inst = insts_[pc];
+    int32_t ret = 0;
+    switch (inst.op) {
+      case kOpPlus:
+      case kOpMinus:
+      case kOpMul:
+      case kOpDiv:
+      case kOpMod:
+        ret = VecArith(inst, &vregs[inst.reg], vregs[inst.reg2], n);
+        break;
+
+      case kOpLoadCol:
+        LoadColumn(src, *layout_, n, inst, &vregs[inst.reg]);
+        break;
+
+      case kOpMov:
+        if (inst.reg != inst.reg2) {
+          VectorRegister* dst = &vregs[inst.reg];
+          const VectorRegister& src = vregs[inst.reg2];
+          dst->type = src.type;
+          memcpy(dst->value, src.value, n * sizeof(DataValue));
+          memcpy(dst->is_unsigned, src.is_unsigned, n);
+          memcpy(dst->is_null, src.is_null, n);
+        }
+        break;
+
+      case kOpCount:
+      case kOpSum:
+      case kOpMax:
+      case kOpMin:
+        ret = AggregateBatch(inst.op, vregs[inst.reg], inst.index, n);
+        break;
+
+      /*
+       * The fused ops go through the scratch registers past kRegTotal, so
+       * the batch path keeps running a whole column per step.
+       */
+      case kOpSumCol:
+        LoadColumn(src, *layout_, n, inst, &vregs[kRegTotal]);
+        ret = AggregateBatch(kOpSum, vregs[kRegTotal], inst.agg, n);
+        break;
+
+      case kOpCountCol:
+        LoadColumn(src, *layout_, n, inst, &vregs[kRegTotal]);
+        ret = AggregateBatch(kOpCount, vregs[kRegTotal], inst.agg, n);
+        break;
+
+      case kOpMulSumCols: {
+        Instruction mul = inst;
+        mul.op = kOpMul;
+        mul.index = inst.index2;
+        mul.type = inst.type2;
+        mul.is_unsigned = inst.is_unsigned2;
+        LoadColumn(src, *layout_, n, inst, &vregs[kRegTotal]);
+        LoadColumn(src, *layout_, n, mul, &vregs[kRegTotal + 1]);
+        ret = VecArith(mul, &vregs[kRegTotal], vregs[kRegTotal + 1], n);
+        if (ret >= 0) {
+          ret = AggregateBatch(kOpSum, vregs[kRegTotal], inst.agg, n);
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+    if (ret < 0) {
+      printf("Overflow, value is out of range\n");
+    }
+    assert(ret >= 0);
+  }
+  return true;
+}
+
+/*
+ * Folds the batch held by |a| into agg result |agg_index| of every row.
+ */
+int32_t AggInterpreter::AggregateBatch(uint8_t op, const VectorRegister& a,
+                                       uint32_t agg_index, uint32_t n) {
+  if (n_gb_cols_) {
+    AggOpReg kernel = nullptr;
+    switch (op) {
+      case kOpCount:
+        kernel = Count;
+        break;
+      case kOpSum:
+        kernel = Sum;
+        break;
+      case kOpMax:
+        kernel = Max;
+        break;
+      case kOpMin:
+        kernel = Min;
+        break;
+      default:
+        assert(0);
+    }
+    return VecAgg(kernel, a, batch_aggs_, agg_index, n);
+  }
+  return VecAggRun(op, a, &agg_results_[agg_index], n);
+}
+
+/*
+ * Folds the partial result |src| of |op| into |dst|, as if the rows behind
+ * it were aggregated into |dst| directly.
+ */
+int32_t CombineAggItem(uint8_t op, const AggResItem& src, AggResItem* dst) {
+  Register a;
+  a.type = src.type;
+  a.value = src.value;
+  a.is_unsigned = src.is_unsigned;
+  a.is_null = false;
+  switch (op) {
+    case kOpCount:
+      dst->value.val_uint64 += src.value.val_uint64;
+      dst->is_unsigned |= src.is_unsigned;
+      return 0;
+    case kOpSum:
+      return Sum(a, dst);
+    case kOpMax:
+    case kOpMin:
+      // BIGINT starts from the first value, DOUBLE from 0 either way.
+      if (src.type == kTypeBigInt && !src.inited) {
+        return 0;
       }
+      return op == kOpMax ? Max(a, dst) : Min(a, dst);
+    default:
+      // Never aggregated.
+      return 0;
+  }
+}
+
+void AggInterpreter::CombineItems(const AggResItem* src,
+                                  AggResItem* dst) const {
+  for (uint32_t i = 0; i < n_agg_results_; i++) {
+    int32_t ret = CombineAggItem(agg_ops_[i], src[i], &dst[i]);
+    if (ret < 0) {
+      printf("Overflow, value is out of range\n");
     }
+    assert(ret >= 0);
+  }
+}
+
+bool AggInterpreter::Merge(const AggInterpreter& other) {
+  assert(inited_ && other.inited_);
+  assert(n_gb_cols_ == other.n_gb_cols_ &&
+         n_agg_results_ == other.n_agg_results_);
+  if (spill_ || spill_run_ || other.spill_ || other.spill_run_) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n_agg_results_; i++) {
+    if (agg_ops_[i] == kOpTotal) {
+      return false;
+    }
+  }
+
+  if (n_gb_cols_ == 0) {
+    CombineItems(other.agg_results_, agg_results_);
+    return true;
+  }
+
+  InitGroupByInfo();
+  uint32_t state_len = n_agg_results_ * sizeof(AggResItem);
+  uint32_t n = other.gb_table_->size();
+  Entry* groups = new Entry[n];
+  other.gb_table_->GetEntries(groups);
+  for (uint32_t g = 0; g < n; g++) {
+    const char* src = groups[g].ptr + groups[g].len;
+    bool inserted = false;
+    char* dst = gb_table_->FindOrInsert(groups[g].ptr, groups[g].len,
+                                        &inserted);
+    if (inserted) {
+      memcpy(dst, src, state_len);
+    } else {
+      CombineItems(reinterpret_cast<const AggResItem*>(src),
+                   reinterpret_cast<AggResItem*>(dst));
+    }
+  }
+  delete[] groups;
+  n_groups_ = gb_table_->size();
+  return true;
+}
+
+/*
+ * Print() takes the types of the group by columns from the first row, or
+ * from the schema when the groups come from elsewhere.
+ */
+void AggInterpreter::InitGroupByInfo() {
+  if (gb_cols_type_inited_) {
+    return;
+  }
+  for (uint32_t i = 0; i < n_gb_cols_; i++) {
+    gb_cols_info_[i] = KeyColInfo(schema_[gb_cols_[i]]);
+  }
+  gb_cols_type_inited_ = true;
+}
+
+/*
+ * The groups in memory that Print() and Serialize() give: those passing
+ * HAVING, in key order if |sorted|, or the top ones set by SetTopN(), best
+ * first. Returns their number, |groups| is to be freed with delete[].
+ */
+uint32_t AggInterpreter::ResultGroups(bool sorted, GroupRef** groups) const {
+  uint32_t n = gb_table_->size();
+  Entry* entries = new Entry[n];
+  gb_table_->GetEntries(entries);
+  if (having_) {
+    uint32_t n_passed = 0;
+    for (uint32_t g = 0; g < n; g++) {
+      if (having_->Pass(reinterpret_cast<AggResItem*>(entries[g].ptr +
+                                                      entries[g].len))) {
+        entries[n_passed++] = entries[g];
+      }
+    }
+    n = n_passed;
+  }
+  if (has_top_n_) {
+    TopNHeap heap(top_n_agg_, top_n_desc_, top_n_limit_, n_agg_results_);
+    for (uint32_t g = 0; g < n; g++) {
+      heap.Offer(entries[g].ptr, entries[g].len,
+                 reinterpret_cast<AggResItem*>(entries[g].ptr +
+                                               entries[g].len), false);
+    }
+    n = heap.size();
+    *groups = new GroupRef[n];
+    memcpy(*groups, heap.Sorted(), n * sizeof(GroupRef));
   } else {
+    if (sorted) {
+      std::sort(entries, entries + n, EntryCmp());
+    }
+    *groups = new GroupRef[n];
+    for (uint32_t g = 0; g < n; g++) {
+      (*groups)[g] = GroupRef{entries[g].ptr, entries[g].len,
+                              reinterpret_cast<AggResItem*>(entries[g].ptr +
+                                                            entries[g].len),
+                              nullptr};
+    }
+  }
+  delete[] entries;
+  return n;
+}
+
+const uint32_t kStateMagic = 0x0723;
+const uint32_t kStateVersion = 1;
+const uint32_t kStateHeaderSize = 3 * sizeof(uint32_t);
+const uint32_t kStateItemSize = sizeof(uint64_t) + 1;
+const uint8_t kStateUnsigned = 0x1;
+const uint8_t kStateInited = 0x2;
+
+size_t AggInterpreter::SerializedSize() const {
+  if (spill_ || spill_run_) {
+    return 0;
+  }
+  size_t group_len = sizeof(uint32_t) + n_agg_results_ * kStateItemSize;
+  if (n_gb_cols_ == 0) {
+    return kStateHeaderSize + n_agg_results_ + group_len;
+  }
+  GroupRef* groups = nullptr;
+  uint32_t n = ResultGroups(false, &groups);
+  size_t size = kStateHeaderSize + n_agg_results_ + n * group_len;
+  for (uint32_t g = 0; g < n; g++) {
+    size += groups[g].key_len;
+  }
+  delete[] groups;
+  return size;
+}
+
+char* SerializeGroup(const char* key, uint32_t key_len,
+                     const AggResItem* items, uint32_t n_items, char* pos) {
+  int4store(pos, key_len);
+  pos += sizeof(uint32_t);
+  if (key_len) {
+    memcpy(pos, key, key_len);
+    pos += key_len;
+  }
+  for (uint32_t i = 0; i < n_items; i++) {
+    uint64_t value;
+    memcpy(&value, &items[i].value, sizeof(value));
+    int8store(pos, value);
+    pos[sizeof(uint64_t)] = (items[i].is_unsigned ? kStateUnsigned : 0) |
+                            (items[i].inited ? kStateInited : 0);
+    pos += kStateItemSize;
+  }
+  return pos;
+}
+
+size_t AggInterpreter::Serialize(uint8_t* buf) const {
+  if (spill_ || spill_run_) {
+    return 0;
+  }
+  GroupRef* groups = nullptr;
+  uint32_t n_groups = n_gb_cols_ ? ResultGroups(false, &groups) : 1;
+  char* pos = reinterpret_cast<char*>(buf);
+  int4store(pos, kStateMagic << 16 | kStateVersion);
+  int4store(pos + 4, n_gb_cols_ << 16 | n_agg_results_);
+  int4store(pos + 8, n_groups);
+  pos += kStateHeaderSize;
+  for (uint32_t i = 0; i < n_agg_results_; i++) {
+    *pos++ = static_cast<char>(agg_results_[i].type);
+  }
+
+  if (n_gb_cols_ == 0) {
+    pos = SerializeGroup(nullptr, 0, agg_results_, n_agg_results_, pos);
+  } else {
+    for (uint32_t g = 0; g < n_groups; g++) {
+      pos = SerializeGroup(groups[g].key, groups[g].key_len, groups[g].items,
+                           n_agg_results_, pos);
+    }
+    delete[] groups;
+  }
+  return pos - reinterpret_cast<char*>(buf);
+}
+
+/*
+ * The key must be the group by columns encoded back to back, each after
+ * its NULL flag and each VARCHAR NUL terminated as Print() expects.
+ */
+bool AggInterpreter::ValidGroupKey(const char* key, uint32_t len) const {
+  uint32_t pos = 0;
+  for (uint32_t i = 0; i < n_gb_cols_; i++) {
+    if (pos >= len || (key[pos] != kKeyNull && key[pos] != kKeyNotNull)) {
+      return false;
+    }
+    if (key[pos++] == kKeyNull) {
+      continue;
+    }
+    switch (KeyColInfo(schema_[gb_cols_[i]]).type) {
+      case kTypeBigInt:
+      case kTypeDouble:
+        pos += sizeof(int64_t);
+        break;
+      case kTypeVarchar: {
+        if (len - pos < sizeof(uint32_t)) {
+          return false;
+        }
+        uint32_t raw_len;
+        memcpy(&raw_len, key + pos, sizeof(raw_len));
+        pos += sizeof(uint32_t);
+        if (raw_len == 0 || raw_len > len - pos ||
+            key[pos + raw_len - 1] != '\0') {
+          return false;
+        }
+        pos += raw_len;
+        break;
+      }
+      default:
+        return false;
+    }
+    if (pos > len) {
+      return false;
+    }
+  }
+  return pos == len;
+}
+
+bool AggInterpreter::MergeSerialized(const uint8_t* buf, size_t len) {
+  assert(inited_);
+  if (spill_ || spill_run_) {
+    return false;
+  }
+  for (uint32_t i = 0; i < n_agg_results_; i++) {
+    if (agg_ops_[i] == kOpTotal) {
+      return false;
+    }
+  }
+
+  /*
+   * 1. Check it all before touching any result.
+   */
+  const char* begin = reinterpret_cast<const char*>(buf);
+  const char* end = begin + len;
+  if (len < kStateHeaderSize + n_agg_results_ ||
+      uint4korr(begin) != (kStateMagic << 16 | kStateVersion) ||
+      uint4korr(begin + 4) != (n_gb_cols_ << 16 | n_agg_results_)) {
+    return false;
+  }
+  uint32_t n_groups = uint4korr(begin + 8);
+  if (n_gb_cols_ == 0 && n_groups != 1) {
+    return false;
+  }
+  const char* pos = begin + kStateHeaderSize;
+  for (uint32_t i = 0; i < n_agg_results_; i++) {
+    if (static_cast<uint8_t>(pos[i]) != agg_results_[i].type) {
+      return false;
+    }
+  }
+  pos += n_agg_results_;
+  const char* groups = pos;
+  size_t items_len = n_agg_results_ * kStateItemSize;
+  for (uint32_t g = 0; g < n_groups; g++) {
+    if (static_cast<size_t>(end - pos) < sizeof(uint32_t)) {
+      return false;
+    }
+    uint32_t key_len = uint4korr(pos);
+    pos += sizeof(uint32_t);
+    if (static_cast<size_t>(end - pos) < key_len ||
+        static_cast<size_t>(end - pos) - key_len < items_len) {
+      return false;
+    }
+    if (n_gb_cols_ ? !ValidGroupKey(pos, key_len) : key_len != 0) {
+      return false;
+    }
+    pos += key_len;
+    for (uint32_t i = 0; i < n_agg_results_; i++) {
+      if (static_cast<uint8_t>(pos[sizeof(uint64_t)]) &
+          ~(kStateUnsigned | kStateInited)) {
+        return false;
+      }
+      pos += kStateItemSize;
+    }
+  }
+  if (pos != end) {
+    return false;
+  }
+
+  /*
+   * 2. Fold every group in.
+   */
+  InitGroupByInfo();
+  AggResItem* items = new AggResItem[n_agg_results_ + 1];
+  uint32_t state_len = n_agg_results_ * sizeof(AggResItem);
+  pos = groups;
+  for (uint32_t g = 0; g < n_groups; g++) {
+    uint32_t key_len = uint4korr(pos);
+    const char* key = pos + sizeof(uint32_t);
+    pos = key + key_len;
+    for (uint32_t i = 0; i < n_agg_results_; i++) {
+      uint64_t value = uint8korr(pos);
+      uint8_t flags = pos[sizeof(uint64_t)];
+      items[i].type = agg_results_[i].type;
+      memcpy(&items[i].value, &value, sizeof(value));
+      items[i].is_unsigned = (flags & kStateUnsigned) != 0;
+      items[i].inited = (flags & kStateInited) != 0;
+      pos += kStateItemSize;
+    }
+
+    if (n_gb_cols_ == 0) {
+      CombineItems(items, agg_results_);
+      continue;
+    }
+    bool inserted = false;
+    char* dst = gb_table_->FindOrInsert(key, key_len, &inserted);
+    if (inserted) {
+      memcpy(dst, items, state_len);
+    } else {
+      CombineItems(items, reinterpret_cast<AggResItem*>(dst));
+    }
+  }
+  delete[] items;
+  if (n_gb_cols_) {
+    n_groups_ = gb_table_->size();
+  }
+  return true;
+}
+
+/*
+ * Aggregates the spilled rows, if any, so all groups are in spill_run_.
+ */
+bool AggInterpreter::FinishSpill() {
+  if (spill_) {
+    spill_run_ = SortedRun();
+    return spill_run_ != nullptr;
+  }
+  return true;
+}
+
+/*
+ * Writes all groups as one sorted run: the ones in memory, then those of
+ * every spill partition, aggregated by a child interpreter one level down,
+ * merged into it. Sets n_groups_ to their number, returns nullptr on I/O
+ * error.
+ */
+FILE* AggInterpreter::SortedRun() {
+  uint32_t state_len = n_agg_results_ * sizeof(AggResItem);
+  FILE* runs[SpillPartitions::kNumPartitions + 1];
+  uint32_t n_runs = 0;
+
+  FILE* run = tmpfile();
+  if (run == nullptr) {
+    return nullptr;
+  }
+  runs[n_runs++] = run;
+  bool ok = true;
+  uint32_t n_groups = gb_table_->size();
+  Entry* groups = new Entry[n_groups];
+  gb_table_->GetEntries(groups);
+  std::sort(groups, groups + n_groups, EntryCmp());
+  for (uint32_t g = 0; ok && g < n_groups; g++) {
+    ok = WriteGroup(run, groups[g].ptr, groups[g].len,
+                    groups[g].ptr + groups[g].len, state_len);
+  }
+  delete[] groups;
+  // Give the memory back to the partitions.
+  delete gb_table_;
+  gb_table_ = new GroupTable(state_len);
+
+  unsigned char* buf = new unsigned char[kBatchSize * layout_->length()];
+  for (uint32_t p = 0; ok && spill_ && p < SpillPartitions::kNumPartitions;
+       p++) {
+    FILE* part = spill_->Partition(p);
+    if (part == nullptr) {
+      continue;
+    }
+    // prog_ is optimized already.
+    AggInterpreter child(prog_, prog_len_, false);
+    child.mem_budget_ = mem_budget_;
+    child.spill_level_ = spill_level_ + 1;
+    if (has_key_range_) {
+      child.SetGroupKeyRange(key_range_min_, key_range_max_);
+    }
+    bool inited = child.Init(schema_, n_cols_);
+    assert(inited);
+    uint32_t n = 0;
+    while (ok && (n = ReadRows(part, layout_->length(), buf, kBatchSize)) > 0) {
+      ok = child.ProcessRows(buf, n);
+    }
+    ok = ok && !ferror(part);
+    run = ok ? child.SortedRun() : nullptr;
+    if (run == nullptr) {
+      ok = false;
+      break;
+    }
+    runs[n_runs++] = run;
+    n_groups += child.n_groups_;
+  }
+  delete[] buf;
+  delete spill_;
+  spill_ = nullptr;
+
+  if (!ok) {
+    for (uint32_t i = 0; i < n_runs; i++) {
+      fclose(runs[i]);
+    }
+    return nullptr;
+  }
+  n_groups_ = n_groups;
+  if (n_runs == 1) {
+    if (fflush(runs[0]) != 0) {
+      fclose(runs[0]);
+      return nullptr;
+    }
+    return runs[0];
+  }
+  return MergeRuns(runs, n_runs, state_len);
+}
+
+void AggInterpreter::PrintGroup(const char* key,
+                                const AggResItem* item) const {
+  int pos = 0;
+  printf("(");
+  for (int i = 0; i < n_gb_cols_; i++) {
+    const char* sep = i != n_gb_cols_ - 1 ? ", " : "): ";
+    // Values follow the NULL flag unaligned.
+    DataValue value;
+    if (key[pos++] == kKeyNull) {
+      printf("%15s%s", "NULL", sep);
+    } else if (gb_cols_info_[i].type == kTypeBigInt) {
+      memcpy(&value, key + pos, sizeof(value));
+      if (gb_cols_info_[i].is_unsigned) {
+        printf("%15lu%s", value.val_uint64, sep);
+      } else {
+        printf("%15ld%s", value.val_int64, sep);
+      }
+      pos += sizeof(int64_t);
+    } else if (gb_cols_info_[i].type == kTypeDouble) {
+      memcpy(&value, key + pos, sizeof(value));
+      printf("%.16f%s", value.val_double, sep);
+      pos += sizeof(double);
+    } else {
+      assert(gb_cols_info_[i].type == kTypeVarchar);
+      uint32_t len;
+      memcpy(&len, key + pos, sizeof(len));
+      pos += sizeof(uint32_t);
+      printf("%15s%s", (key + pos), sep);
+      pos += len;
+    }
+  }
+
+  for (int i = 0; i < n_agg_results_; i++) {
+    switch (item[i].type) {
+      case kTypeBigInt:
+        // printf("    (kTypeBigInt: %ld)\n", item[i].value.val_int64);
+        printf("[%15ld]", item[i].value.val_int64);
+        break;
+
+      case kTypeDouble:
+        // printf("    (kTypeDouble: %.16f)\n", item[i].value.val_double);
+        printf("[%31.16f]", item[i].value.val_double);
+        break;
+      default:
+        assert(0);
+    }
+  }
+  printf("\n");
+}
+
+void AggInterpreter::Print() {
+  if (n_gb_cols_) {
+    // The table is unordered, the cursor sorts the groups or picks the top.
+    ResultCursor cursor(this, true);
+    if (!cursor.ok()) {
+      printf("Failed to aggregate the spilled rows\n");
+      return;
+    }
+    if (gb_table_) {
+      printf("Group by columns: [");
+      for (int i = 0; i < n_gb_cols_; i++) {
+        if (i != n_gb_cols_ - 1) {
+          printf("%u ", gb_cols_[i]);
+        } else {
+          printf("%u", gb_cols_[i]);
+        }
+      }
+      printf("]\n");
+      printf("Aggregation results:\n");
+
+      // Counted as printed, HAVING and the top N leave out groups.
+      const uint8_t* key = nullptr;
+      uint32_t key_len = 0;
+      const AggResItem* items = nullptr;
+      uint32_t n_groups = 0;
+      while (cursor.Next(&key, &key_len, &items)) {
+        PrintGroup(reinterpret_cast<const char*>(key), items);
+        n_groups++;
+      }
+      printf("Num of groups: %u\n", n_groups);
+    }
+  } else {
+    if (having_ && !having_->Pass(agg_results_)) {
+      return;
+    }
     AggResItem* item = agg_results_;
     for (int i = 0; i < n_agg_results_; i++) {
       switch (item[i].type) {
@@ -7,16 +7,28 @@
 #define INTERPRETER_H_
 
 #include <math.h>
-#include <map>
+#include <stdio.h>
 
 #include "my_byteorder.h"
 #include "record.h"
 
+class GroupTable;
+class SpillPartitions;
+class HavingFilter;
+struct GroupRef;
+
 struct Entry {
   char *ptr;
   uint32_t len;
 };
 
+/*
+ * Each group by column of a key starts with one of these. A NULL has no
+ * value after it, so NULLs group together whatever bytes lie under them.
+ */
+const uint8_t kKeyNull = 0;
+const uint8_t kKeyNotNull = 1;
+
 enum InterpreterOp {
   kOpUnknown = 0,
   kOpPlus,
@@ -30,6 +42,14 @@ enum InterpreterOp {
   kOpMax,
   kOpMin,
   kOpCount,
+  kOpMov,
+  /*
+   * Fused ops, never on the wire. Init() folds the common LOADCOL, MUL and
+   * aggregation sequences into them.
+   */
+  kOpSumCol,
+  kOpCountCol,
+  kOpMulSumCols,
   kOpTotal
 };
 
@@ -74,6 +94,36 @@ struct Register {
   bool is_null;
 };
 
+typedef int32_t (*RegOpReg)(const Register& a, const Register& b,
+                            Register* res);
+
+/*
+ * Num of rows ProcessBatch() runs every instruction over at a time.
+ */
+const uint32_t kBatchSize = 1024;
+
+/*
+ * A register holding the values of a whole batch. Each field is a separate
+ * array so the typed loops over it can be vectorized by the compiler.
+ */
+struct VectorRegister {
+  DataType type;
+  DataValue value[kBatchSize];
+  bool is_unsigned[kBatchSize];
+  bool is_null[kBatchSize];
+};
+
+/*
+ * The rows of a batch, either encoded rows or rows [start, start + n) of
+ * a ColumnBatch, or those listed in |sel| once spilled rows are left out.
+ */
+struct BatchSource {
+  const unsigned char* const* rows;
+  const ColumnBatch* cols;
+  uint32_t start;
+  const uint32_t* sel;
+};
+
 struct AggResItem {
   DataType type;
   DataValue value;
@@ -86,37 +136,227 @@ struct GBColInfo {
   bool is_unsigned;
 };
 
+/*
+ * An instruction of the aggregation program decoded once in Init().
+ * |handler| is the dispatch target bound to |op|, so the hot loop never
+ * touches the masks and shifts of the wire format again. Arithmetic
+ * instructions and MULSUMCOLS also get |kernel|, specialized for the operand
+ * types.
+ */
+struct Instruction {
+  const void* handler;
+  RegOpReg kernel;
+  uint8_t op;
+  uint8_t type;
+  uint8_t type2;
+  uint8_t reg;
+  uint8_t reg2;
+  bool is_unsigned;
+  bool is_unsigned2;
+  uint16_t index;  // column index for LOADCOL, agg result index for aggs
+  uint16_t index2;  // fused ops: 2nd column index
+  uint16_t agg;  // fused ops: agg result index
+};
+
+/*
+ * Conversion between an instruction and its wire format. MOV copies the
+ * register reg2 into reg and is encoded like the arithmetic instructions.
+ */
+void DecodeInstruction(uint32_t value, Instruction* inst);
+uint32_t EncodeInstruction(const Instruction& inst);
+/*
+ * Type of the register a column of |type| is loaded in: integers widen to
+ * BIGINT, FLOAT to DOUBLE.
+ */
+DataType CeilType(DataType type);
+
+enum VerifyError {
+  kVerifyOk = 0,
+  kVerifyBadHeader,          // wrong magic, length or truncated header
+  kVerifyBadGroupByCol,      // group by column not in the schema
+  kVerifyBadAggType,         // aggregation result neither BIGINT nor DOUBLE
+  kVerifyBadOp,              // unknown opcode
+  kVerifyBadReg,             // register index out of range
+  kVerifyUninitReg,          // register read before written
+  kVerifyBadCol,             // LOADCOL column not in the schema
+  kVerifyColTypeMismatch,    // LOADCOL type differs from the schema
+  kVerifyOperandMismatch,    // arithmetic operand type differs from inferred
+  kVerifyBadAggIndex,        // aggregation result index out of range
+  kVerifyAggTypeMismatch,    // aggregated register or result of wrong type
+  kVerifyBadSchema           // more columns than a row has validity bits
+};
+
 class AggInterpreter {
  public:
-  AggInterpreter(const uint32_t* prog, uint32_t prog_len):
+  /*
+   * With |optimize| Init() runs the program through OptimizeProgram() first.
+   */
+  AggInterpreter(const uint32_t* prog, uint32_t prog_len,
+                 bool optimize = true):
     prog_(prog), prog_len_(prog_len), cur_pos_(0),
+    optimize_(optimize), opt_prog_(nullptr), error_(kVerifyOk),
     inited_(false), n_gb_cols_(0), gb_cols_(nullptr),
     n_agg_results_(0),
-    agg_results_(nullptr), agg_prog_start_pos_(0),
-    gb_map_(nullptr), n_groups_(0),
-    gb_cols_type_inited_(false), gb_cols_info_(nullptr) {
-  }
-  ~AggInterpreter() {
-    delete[] gb_cols_;
-    delete[] agg_results_;
-    if (gb_map_) {
-      for (auto iter = gb_map_->begin(); iter != gb_map_->end(); iter++) {
-        delete[] iter->first.ptr;
-      }
-      delete gb_map_;
-      delete[] gb_cols_info_;
-    }
+    agg_results_(nullptr), agg_ops_(nullptr), agg_prog_start_pos_(0),
+    gb_table_(nullptr), n_groups_(0), key_buf_(nullptr), key_buf_len_(0),
+    has_key_range_(false), key_range_min_(0), key_range_max_(0),
+    gb_cols_type_inited_(false), gb_cols_info_(nullptr),
+    schema_(nullptr), n_cols_(0), layout_(nullptr), mem_budget_(0),
+    spill_level_(0), spill_(nullptr), spill_run_(nullptr),
+    spill_row_(nullptr),
+    has_top_n_(false), top_n_agg_(0), top_n_desc_(false), top_n_limit_(0),
+    having_prog_(nullptr), having_prog_len_(0), having_(nullptr),
+    insts_(nullptr), n_insts_(0),
+    vregisters_(nullptr), batch_aggs_(nullptr), batch_rows_(nullptr),
+    batch_sel_(nullptr) {
   }
+  ~AggInterpreter();
 
-  bool Init();
+  /*
+   * Verifies the program against |schema| with VerifyProgram() and returns
+   * false, leaving the reason in error(), if it's rejected. Once accepted,
+   * the program runs without any per row type check, so the records given
+   * to ProcessRec()/ProcessBatch() must match |schema|. Columns narrower
+   * than BIGINT/DOUBLE are widened to their CeilType() as they're loaded,
+   * and so are group by values in the keys.
+   */
+  bool Init(const ColumnDef* schema = Record::schema_,
+            uint32_t n_cols = Record::n_cols);
+  VerifyError error() const {
+    return error_;
+  }
+  /*
+   * Hint, given before Init(), that the single BIGINT group by column takes
+   * values within [min, max]. Keys in it are aggregated in a dense array
+   * indexed by the key from the first row. Without it, they are once enough
+   * groups fill their range, see GroupTable.
+   */
+  void SetGroupKeyRange(int64_t min, int64_t max) {
+    has_key_range_ = true;
+    key_range_min_ = min;
+    key_range_max_ = max;
+  }
+  /*
+   * Caps, given before Init(), the bytes the group table may hold, 0 for no
+   * limit. Once it's full, the rows of groups not in it yet are spilled to
+   * temporary files by key hash, and Print() aggregates those partition by
+   * partition, each under the same budget, so the results stay exact.
+   */
+  void SetMemoryBudget(size_t bytes) {
+    mem_budget_ = bytes;
+  }
 
   bool ProcessRec(Record* rec);
+  /*
+   * Same as calling ProcessRec() on each of |recs|, but every instruction
+   * runs over up to kBatchSize rows at once.
+   */
+  bool ProcessBatch(Record* const* recs, uint32_t n);
+  /*
+   * ProcessBatch() of |n| rows packed back to back in |rows|, each
+   * row_length() bytes laid out by the RowLayout of the schema, as
+   * Record::buf() is for Record::schema_. Values are read where they are,
+   * so no Record is needed per row.
+   */
+  bool ProcessRows(const unsigned char* rows, uint32_t n);
+  uint32_t row_length() const {
+    return layout_->length();
+  }
+  /*
+   * ProcessBatch() of the rows of |batch|, which has a column for each one
+   * of the schema given to Init(). LOADCOL takes a whole slice of a column
+   * at once. Returns false if the columns don't match the schema.
+   */
+  bool ProcessColumns(const ColumnBatch& batch);
+  /*
+   * Folds the results of |other|, run with the same program over other
+   * rows, into this one's, combining each agg result by the op computing
+   * it: SUM and COUNT add up, MAX and MIN keep the extreme. Returns false,
+   * leaving this one unchanged, if an agg result is computed by different
+   * ops or either side spilled.
+   */
+  bool Merge(const AggInterpreter& other);
+  /*
+   * ORDER BY agg result |agg_index| [DESC] LIMIT |limit|: Print() and
+   * Serialize() give only the first |limit| groups in that order, ties by
+   * key. A heap of up to |limit| groups picks them, so no other group is
+   * sorted or copied. It's meant for the final results: a partial cut to its
+   * own top groups would lose the rows of groups ranking higher elsewhere.
+   */
+  void SetTopN(uint32_t agg_index, bool descending, uint32_t limit) {
+    has_top_n_ = true;
+    top_n_agg_ = agg_index;
+    top_n_desc_ = descending;
+    top_n_limit_ = limit;
+  }
+  /*
+   * HAVING: given before Init(), which rejects it as it would a bad
+   * program, the HavingFilter program |prog| drops the groups failing it
+   * from Print() and Serialize(), before SetTopN() picks any. Ungrouped
+   * results are still serialized. As with SetTopN(), it belongs on the
+   * final results, not on partials.
+   */
+  void SetHaving(const uint32_t* prog, uint32_t prog_len) {
+    having_prog_ = prog;
+    having_prog_len_ = prog_len;
+  }
+  /*
+   * The results in a compact binary format, for a coordinator to fold into
+   * its own with MergeSerialized():
+   *
+   *   [0x0723 << 16 | version] [n_gb_cols << 16 | n_aggs] [n_groups]
+   *   [type of each agg result, 1 byte each]
+   *   n_groups x ([key_len] [key] n_aggs x ([value, 8 bytes] [flags, 1 byte]))
+   *
+   * Numbers are little endian, 4 bytes unless noted, and the key is the
+   * group by columns as encoded by the record, numbers widened to 8 bytes,
+   * each after a kKeyNull or kKeyNotNull byte, a NULL without a value.
+   * The result types are in the header once, so a result takes 9 bytes
+   * instead of an AggResItem. An ungrouped program has a single group with
+   * an empty key.
+   *
+   * SerializedSize() is the length of the buffer Serialize() fills, 0 if
+   * the groups spilled.
+   */
+  size_t SerializedSize() const;
+  size_t Serialize(uint8_t* buf) const;
+  /*
+   * Merge() of results serialized by an interpreter of the same program.
+   * Keys are looked up in |buf| where they are, only new groups are copied.
+   * Returns false, leaving the results unchanged, if |buf| is malformed or
+   * doesn't match the program.
+   */
+  bool MergeSerialized(const uint8_t* buf, size_t len);
   void Print();
 
  private:
+  friend class ResultCursor;
+
+  bool Decode();
+  void Fuse();
+  void FindGroup(uint32_t key_len, AggResItem** items);
+  bool GetAggResItems(const unsigned char* row, AggResItem** items);
+  bool GetAggResItems(const ColumnBatch& batch, uint32_t r,
+                      AggResItem** items);
+  bool Execute(const unsigned char* row, AggResItem* agg_res_ptr);
+  void InitBatch();
+  bool ExecuteBatch(BatchSource src, uint32_t n);
+  int32_t AggregateBatch(uint8_t op, const VectorRegister& a,
+                         uint32_t agg_index, uint32_t n);
+  bool FinishSpill();
+  FILE* SortedRun();
+  void PrintGroup(const char* key, const AggResItem* item) const;
+  void CombineItems(const AggResItem* src, AggResItem* dst) const;
+  void InitGroupByInfo();
+  uint32_t ResultGroups(bool sorted, GroupRef** groups) const;
+  bool ValidGroupKey(const char* key, uint32_t len) const;
+
   const uint32_t* prog_;
   uint32_t prog_len_;
   uint32_t cur_pos_;
+  bool optimize_;
+  uint32_t* opt_prog_;
+  VerifyError error_;
   bool inited_;
   Register registers_[kRegTotal];
 
@@ -124,11 +364,45 @@ class AggInterpreter {
   uint32_t* gb_cols_;
   uint32_t n_agg_results_;
   AggResItem* agg_results_;
+  // Op computing each agg result, kOpTotal if more than one does.
+  uint8_t* agg_ops_;
   uint32_t agg_prog_start_pos_;
 
-  std::map<Entry, Entry, EntryCmp>* gb_map_;
+  GroupTable* gb_table_;
   uint32_t n_groups_;
+  // Scratch buffer the group key of a row is built in for the lookup.
+  char* key_buf_;
+  uint32_t key_buf_len_;
+  bool has_key_range_;
+  int64_t key_range_min_;
+  int64_t key_range_max_;
   bool gb_cols_type_inited_;
   GBColInfo* gb_cols_info_;
+
+  const ColumnDef* schema_;
+  uint32_t n_cols_;
+  RowLayout* layout_;
+  size_t mem_budget_;
+  uint32_t spill_level_;
+  SpillPartitions* spill_;
+  FILE* spill_run_;  // all groups, sorted, once the spilled rows are done
+  unsigned char* spill_row_;  // a columnar row encoded for spilling
+
+  bool has_top_n_;
+  uint32_t top_n_agg_;
+  bool top_n_desc_;
+  uint32_t top_n_limit_;
+
+  const uint32_t* having_prog_;
+  uint32_t having_prog_len_;
+  HavingFilter* having_;
+
+  Instruction* insts_;
+  uint32_t n_insts_;
+
+  VectorRegister* vregisters_;
+  AggResItem** batch_aggs_;
+  const unsigned char** batch_rows_;  // rows of the batch, then not spilled
+  uint32_t* batch_sel_;  // columnar rows not spilled
 };
 #endif  // INTERPRETER_H_
@@ -1,7 +1,12 @@
 #include <stdlib.h>
-#include <fstream>
+#include <unistd.h>
+#include <chrono>
 
+#include "csv_loader.h"
+#include "having.h"
 #include "interpreter.h"
+#include "parallel.h"
+#include "table_file.h"
 
 /*
  * Table definition
@@ -27,7 +32,48 @@ const uint32_t g_prog_len = 51;
 const uint32_t ins_pos = 11;
 uint32_t program[g_prog_len];
 
-int main() {
+// Rows parsed from data.txt before they're aggregated at once.
+const uint32_t g_chunk_size = 256 * kBatchSize;
+
+/*
+ * Aggregates |n_rows| rows packed in |rows|.
+ */
+void Aggregate(AggInterpreter* agg, ParallelAggregator* pagg,
+               uint32_t n_threads, const unsigned char* rows,
+               uint32_t n_rows) {
+  if (n_threads > 1) {
+    pagg->ProcessRows(rows, n_rows);
+  } else {
+    agg->ProcessRows(rows, n_rows);
+  }
+}
+
+/*
+ * Prints the results once all rows are aggregated, returns the exit code.
+ */
+int Finish(AggInterpreter* agg, ParallelAggregator* pagg, uint32_t n_threads,
+           int64_t limit, uint32_t order_agg, bool descending) {
+  AggInterpreter* res = agg;
+  if (n_threads > 1) {
+    res = pagg->Finish();
+    if (res == nullptr) {
+      printf("Failed to merge the results of the threads\n");
+      return 1;
+    }
+  }
+  if (limit >= 0) {
+    if (order_agg >= (program[1] & 0xFFFF)) {
+      printf("No agg result %u\n", order_agg);
+      return 1;
+    }
+    res->SetTopN(order_agg, descending, limit);
+  }
+  res->Print();
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
 
   memset(program, 0, sizeof(program));
   program[0] = ((uint16_t)0x0721) << 16 | (uint16_t)g_prog_len;
@@ -227,7 +273,7 @@ int main() {
   program[ins_pos + 30] =
                 ((uint8_t)kOpDiv) << 26 |                                    // DIV
                 0 << 25 | (uint8_t)(kTypeDouble << 4) << 17 |                // kTypeDouble (Reg 1)
-                0 << 20 | (uint8_t)(kTypeDouble << 4) << 12 |                // kTypeDouble (Reg 2)
+                1 << 20 | (uint8_t)(kTypeBigInt << 4) << 12 |                // unsigned kTypeBigInt (Reg 2)
                 ((uint8_t)kReg1 & 0x0F) << 12 | ((uint8_t)kReg2 & 0xF) << 8; // Register 1, Register 2
 
   program[ins_pos + 31] =
@@ -284,45 +330,153 @@ int main() {
                 ((uint8_t)kReg2 & 0x0F) << 16 |                          // Register 2
                 (uint16_t)7;                                             // agg_result 7
 
+  /*
+   * -m <MB>: memory budget of the group table.
+   * -t <N>: aggregate on N threads.
+   * -l <N> [-o <agg>] [-d]: print the first N groups ordered by agg result
+   *    agg, 0 by default, descending with -d.
+   * -c <N>: HAVING count(a) > N.
+   * -b: read the rows from the table file data.tbl, see table_file.h,
+   *    instead of parsing data.txt.
+   */
+  size_t mem_budget = 0;
+  uint32_t n_threads = 1;
+  int64_t limit = -1;
+  uint32_t order_agg = 0;
+  bool descending = false;
+  bool has_having = false;
+  bool binary = false;
+  uint32_t having[6];
+  int opt;
+  while ((opt = getopt(argc, argv, "m:t:l:o:dc:b")) != -1) {
+    switch (opt) {
+      case 'm':
+        mem_budget = strtoull(optarg, nullptr, 10) << 20;
+        break;
+      case 't':
+        n_threads = strtoul(optarg, nullptr, 10);
+        break;
+      case 'l':
+        limit = strtoll(optarg, nullptr, 10);
+        if (limit < 0 || limit > UINT32_MAX) {
+          printf("Limit from 0 to %u\n", UINT32_MAX);
+          return 1;
+        }
+        break;
+      case 'o':
+        order_agg = strtoul(optarg, nullptr, 10);
+        break;
+      case 'd':
+        descending = true;
+        break;
+      case 'c': {
+        int64_t count = strtoll(optarg, nullptr, 10);
+        has_having = true;
+        having[0] = ((uint16_t)0x0722) << 16 | 6;
+        having[1] =
+               ((uint8_t)kOpLoadCol) << 26 |                             // LOADCOL
+               0 << 25 | (uint8_t)(kTypeBigInt << 4) << 17 |             // kTypeBigInt
+               ((uint8_t)kReg1 & 0x0F) << 16 |                           // Register 1
+               (uint16_t)0;                                              // agg_result 0
+        having[2] =
+               ((uint8_t)kOpLoadConst) << 26 |                           // LOADCONST
+               0 << 25 | (uint8_t)(kTypeBigInt << 4) << 17 |             // kTypeBigInt
+               ((uint8_t)kReg2 & 0x0F) << 16;                            // Register 2
+        having[3] = (uint32_t)count;                                     // low word
+        having[4] = (uint32_t)((uint64_t)count >> 32);                   // high word
+        having[5] =
+                ((uint8_t)kOpGt) << 26 |                                     // GT
+                0 << 25 | (uint8_t)(kTypeBigInt << 4) << 17 |                // kTypeBigInt (Reg 1)
+                0 << 20 | (uint8_t)(kTypeBigInt << 4) << 12 |                // kTypeBigInt (Reg 2)
+                ((uint8_t)kReg1 & 0x0F) << 12 | ((uint8_t)kReg2 & 0xF) << 8; // Register 1, Register 2
+        break;
+      }
+      case 'b':
+        binary = true;
+        break;
+      default:
+        printf("Usage: %s [-m budget_mb] [-t threads] "
+               "[-l limit [-o agg] [-d]] [-c min_count] [-b]\n", argv[0]);
+        return 1;
+    }
+  }
+
   AggInterpreter agg(program, g_prog_len);
-  agg.Init();
-
-  char buf[256];
-  std::fstream fs;
-  fs.open("data.txt", std::fstream::in);
-  while (!fs.eof()) {
-    fs.getline(buf, 256);
-    std::string str(buf);
-    if (str.length() == 0) {
-      break;
+  ParallelAggregator pagg(program, g_prog_len, n_threads);
+  if (n_threads > 1) {
+    // Partial results are merged, the budget isn't applied.
+    if (has_having) {
+      pagg.SetHaving(having, 6);
+    }
+    if (!pagg.Init()) {
+      printf("Invalid program, error %d\n", pagg.error());
+      return 1;
+    }
+  } else {
+    agg.SetMemoryBudget(mem_budget);
+    if (has_having) {
+      agg.SetHaving(having, 6);
+    }
+    if (!agg.Init()) {
+      printf("Invalid program, error %d\n", agg.error());
+      return 1;
     }
-    size_t start = 0;
-    size_t pos = str.find(',', start);
-    std::string str1 = str.substr(start, pos - start);
-    start = pos + 1;
-    pos = str.find(',', start);
-    std::string str2 = str.substr(start, pos - start);
-    start = pos + 1;
-    pos = str.find(',', start);
-    std::string str3 = str.substr(start, pos - start);
-    start = pos + 1;
-    pos = str.find(',', start);
-    std::string str4 = str.substr(start, pos - start);
-    start = pos + 1;
-    pos = str.find(',', start);
-    std::string str5 = str.substr(start);
-    start = pos + 1;
-    int64_t v1 = std::stoll(str1);
-    double v2 = std::stod(str2);
-    uint64_t v3 = std::stoull(str3);
-    double v4 = std::stod(str4);
-    int64_t v5 = std::stoll(str5);
-    Record rec(v1, v2, v3, v4, v5, "aaaaaaaaaa\0", 12);
-    // rec.Print();
-    agg.ProcessRec(&rec);
   }
 
-  agg.Print();
+  if (binary) {
+    // The rows are aggregated straight from the mapped file.
+    TableFile table;
+    if (!table.Open("data.tbl") ||
+        !table.SchemaIs(Record::schema_, Record::n_cols)) {
+      printf("Failed to open data.tbl\n");
+      return 1;
+    }
+    for (uint64_t start = 0; start < table.n_rows(); start += g_chunk_size) {
+      uint64_t left = table.n_rows() - start;
+      uint32_t n_rows = left < g_chunk_size ? left : g_chunk_size;
+      if (!table.ValidRows(start, n_rows)) {
+        printf("Malformed row in rows %llu to %llu of data.tbl\n",
+               static_cast<unsigned long long>(start),
+               static_cast<unsigned long long>(start + n_rows - 1));
+        return 1;
+      }
+      Aggregate(&agg, &pagg, n_threads,
+                table.rows() + start * table.row_length(), n_rows);
+    }
+    return Finish(&agg, &pagg, n_threads, limit, order_agg, descending);
+  }
 
-  return 0;
+  // data.txt has no VARCHAR column, every row gets the same e.
+  unsigned char defaults[Record::encoded_length_];
+  Record::Encode(0, 0, 0, 0, 0, "aaaaaaaaaa\0", 12, defaults);
+  CsvLoader loader(Record::schema_, Record::n_cols, 5, defaults);
+  if (!loader.Open("data.txt")) {
+    printf("Failed to open data.txt\n");
+    return 1;
+  }
+  unsigned char* rows =
+      new unsigned char[g_chunk_size * loader.row_length()];
+  std::chrono::steady_clock::duration parse_time(0);
+  while (true) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    uint32_t n_rows = loader.Next(rows, g_chunk_size);
+    parse_time += std::chrono::steady_clock::now() - start;
+    if (n_rows == 0) {
+      break;
+    }
+    Aggregate(&agg, &pagg, n_threads, rows, n_rows);
+  }
+  delete[] rows;
+  if (loader.error()) {
+    printf("Malformed line at byte %zu of data.txt\n",
+           loader.bytes_parsed());
+    return 1;
+  }
+  double parse_secs = std::chrono::duration<double>(parse_time).count();
+  double parse_mb = loader.bytes_parsed() / 1048576.0;
+  fprintf(stderr, "Parsed %.1f MB in %.3f s, %.1f MB/s\n", parse_mb,
+          parse_secs, parse_secs > 0 ? parse_mb / parse_secs : 0);
+
+  return Finish(&agg, &pagg, n_threads, limit, order_agg, descending);
 }
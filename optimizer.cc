@@ -0,0 +1,225 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+#include <string.h>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "optimizer.h"
+
+namespace {
+
+/*
+ * A value computed by the program. Loading the same column, or applying
+ * the same operation to the same values, always gives the same value
+ * whatever register it lands in.
+ */
+struct Value {
+  Instruction def;    // first instruction computing the value
+  int32_t a;          // operand values of an arithmetic op, -1 for LOADCOL
+  int32_t b;
+  bool used;          // some aggregation depends on it
+  uint32_t last_use;  // last step reading it
+  int32_t reg;        // register assigned in the rewritten program
+};
+
+/*
+ * A step of the rewritten program, either computing |val| or aggregating it.
+ */
+struct Step {
+  bool is_agg;
+  int32_t val;
+  Instruction agg;
+};
+
+typedef std::tuple<uint32_t, int32_t, int32_t> ValueKey;
+
+bool IsArith(uint8_t op) {
+  return op == kOpPlus || op == kOpMinus || op == kOpMul ||
+         op == kOpDiv || op == kOpMod;
+}
+
+bool IsAgg(uint8_t op) {
+  return op == kOpSum || op == kOpMax || op == kOpMin || op == kOpCount;
+}
+
+int32_t AllocReg(bool* free_regs) {
+  for (int32_t i = 0; i < kRegTotal; i++) {
+    if (free_regs[i]) {
+      free_regs[i] = false;
+      return i;
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+uint32_t OptimizeProgram(const uint32_t* prog, uint32_t prog_len,
+                         uint32_t* out) {
+  if (prog_len < 2 || ((prog[0] & 0xFFFF0000) >> 16) != 0x0721 ||
+      (prog[0] & 0xFFFF) != prog_len) {
+    return 0;
+  }
+  uint32_t n_gb_cols = (prog[1] >> 16) & 0xFFFF;
+  uint32_t n_aggs = prog[1] & 0xFFFF;
+  uint32_t start = 2 + n_gb_cols + n_aggs;
+  if (start >= prog_len) {
+    return 0;
+  }
+
+  /*
+   * 1. Number the values held by each register along the program.
+   */
+  std::vector<Value> vals;
+  std::vector<Step> steps;
+  std::map<ValueKey, int32_t> numbering;
+  int32_t reg_val[kRegTotal];
+  for (uint32_t i = 0; i < kRegTotal; i++) {
+    reg_val[i] = -1;
+  }
+
+  for (uint32_t pos = start; pos < prog_len; pos++) {
+    Instruction inst;
+    DecodeInstruction(prog[pos], &inst);
+    if (inst.op == kOpLoadCol || IsArith(inst.op) || inst.op == kOpMov ||
+        IsAgg(inst.op)) {
+      if (inst.reg >= kRegTotal || inst.reg2 >= kRegTotal) {
+        return 0;
+      }
+    }
+
+    if (inst.op == kOpLoadCol || IsArith(inst.op)) {
+      ValueKey key;
+      int32_t a = -1;
+      int32_t b = -1;
+      if (inst.op == kOpLoadCol) {
+        key = ValueKey(inst.op << 8 | (inst.is_unsigned ? 0x10 : 0) |
+                       inst.type, inst.index, -1);
+      } else {
+        a = reg_val[inst.reg];
+        b = reg_val[inst.reg2];
+        if (a < 0 || b < 0) {
+          return 0;
+        }
+        key = ValueKey(inst.op << 8, a, b);
+      }
+      auto iter = numbering.find(key);
+      if (iter == numbering.end()) {
+        int32_t val = static_cast<int32_t>(vals.size());
+        vals.push_back(Value{inst, a, b, false, 0, -1});
+        numbering[key] = val;
+        steps.push_back(Step{false, val, Instruction()});
+        reg_val[inst.reg] = val;
+      } else {
+        reg_val[inst.reg] = iter->second;
+      }
+    } else if (inst.op == kOpMov) {
+      if (reg_val[inst.reg2] < 0) {
+        return 0;
+      }
+      reg_val[inst.reg] = reg_val[inst.reg2];
+    } else if (IsAgg(inst.op)) {
+      if (reg_val[inst.reg] < 0) {
+        return 0;
+      }
+      steps.push_back(Step{true, reg_val[inst.reg], inst});
+    }
+    // Anything else does nothing at run time and is dropped.
+  }
+
+  /*
+   * 2. Keep the values some aggregation depends on. Operands are always
+   *    computed before the values using them, so one backward pass is enough.
+   */
+  for (uint32_t i = steps.size(); i-- > 0;) {
+    Value* val = &vals[steps[i].val];
+    if (steps[i].is_agg) {
+      val->used = true;
+    } else if (val->used && val->a >= 0) {
+      vals[val->a].used = true;
+      vals[val->b].used = true;
+    }
+  }
+  std::vector<Step> live;
+  for (uint32_t i = 0; i < steps.size(); i++) {
+    if (steps[i].is_agg || vals[steps[i].val].used) {
+      live.push_back(steps[i]);
+    }
+  }
+  for (uint32_t i = 0; i < live.size(); i++) {
+    const Value& val = vals[live[i].val];
+    if (live[i].is_agg) {
+      vals[live[i].val].last_use = i;
+    } else if (val.a >= 0) {
+      vals[val.a].last_use = i;
+      vals[val.b].last_use = i;
+    }
+  }
+
+  /*
+   * 3. Assign registers. An arithmetic op overwrites its first operand, so
+   *    copy that operand first if it's read again later.
+   */
+  std::vector<uint32_t> res(prog + 1, prog + start);
+  bool free_regs[kRegTotal];
+  for (uint32_t i = 0; i < kRegTotal; i++) {
+    free_regs[i] = true;
+  }
+  for (uint32_t i = 0; i < live.size(); i++) {
+    Value* val = &vals[live[i].val];
+    if (live[i].is_agg) {
+      Instruction inst = live[i].agg;
+      inst.reg = val->reg;
+      res.push_back(EncodeInstruction(inst));
+      if (val->last_use == i) {
+        free_regs[val->reg] = true;
+      }
+      continue;
+    }
+
+    Instruction inst = val->def;
+    if (val->a < 0) {
+      inst.reg = AllocReg(free_regs);
+    } else {
+      const Value& a = vals[val->a];
+      const Value& b = vals[val->b];
+      if (a.last_use == i) {
+        inst.reg = a.reg;
+      } else {
+        int32_t reg = AllocReg(free_regs);
+        if (reg < 0) {
+          return 0;
+        }
+        Instruction mov;
+        memset(&mov, 0, sizeof(mov));
+        mov.op = kOpMov;
+        mov.reg = reg;
+        mov.reg2 = a.reg;
+        res.push_back(EncodeInstruction(mov));
+        inst.reg = reg;
+      }
+      inst.reg2 = b.reg;
+      if (val->b != val->a && b.last_use == i) {
+        free_regs[b.reg] = true;
+      }
+    }
+    if (inst.reg >= kRegTotal) {
+      return 0;
+    }
+    val->reg = inst.reg;
+    res.push_back(EncodeInstruction(inst));
+  }
+
+  uint32_t len = res.size() + 1;
+  if (len >= prog_len) {
+    return 0;
+  }
+  out[0] = (prog[0] & 0xFFFF0000) | len;
+  memcpy(out + 1, res.data(), res.size() * sizeof(uint32_t));
+  return len;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef OPTIMIZER_H_
+#define OPTIMIZER_H_
+
+#include "interpreter.h"
+
+/*
+ * Rewrites the aggregation program |prog| into a shorter one with the same
+ * results, bit for bit:
+ *   1. Every value is computed once per record. A column already sitting in
+ *      a register is not loaded again, and an operation over the same values
+ *      shared by several aggregate expressions, e.g. c*d in sum(a/b+c*d) and
+ *      sum(c*d), is not evaluated again.
+ *   2. Values no aggregation depends on are never computed.
+ *   3. Registers are reassigned so values needed again stay live, copying
+ *      them with MOV before an operation overwrites them.
+ * The instruction set has no constant operands, so there is nothing to fold.
+ *
+ * |out| must have room for |prog_len| words. Returns the length of the
+ * rewritten program, or 0 if the program can't be made shorter (or isn't
+ * understood, e.g. reads a register before writing it), in which case the
+ * original program should be used as is.
+ */
+uint32_t OptimizeProgram(const uint32_t* prog, uint32_t prog_len,
+                         uint32_t* out);
+
+#endif  // OPTIMIZER_H_
@@ -0,0 +1,194 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+
+#include "parallel.h"
+
+ParallelAggregator::ParallelAggregator(const uint32_t* prog,
+                                       uint32_t prog_len, uint32_t n_threads)
+  : n_threads_(n_threads ? n_threads : 1), threads_(nullptr), round_(0),
+    n_running_(0), stop_(false), failed_(false), recs_(nullptr),
+    rows_(nullptr) {
+  interps_ = new AggInterpreter*[n_threads_];
+  for (uint32_t i = 0; i < n_threads_; i++) {
+    interps_[i] = new AggInterpreter(prog, prog_len);
+  }
+  queues_ = new WorkQueue[n_threads_];
+}
+
+ParallelAggregator::~ParallelAggregator() {
+  StopWorkers();
+  for (uint32_t i = 0; i < n_threads_; i++) {
+    delete interps_[i];
+  }
+  delete[] interps_;
+  delete[] queues_;
+}
+
+void ParallelAggregator::SetHaving(const uint32_t* prog, uint32_t prog_len) {
+  for (uint32_t i = 0; i < n_threads_; i++) {
+    interps_[i]->SetHaving(prog, prog_len);
+  }
+}
+
+bool ParallelAggregator::Init(const ColumnDef* schema, uint32_t n_cols) {
+  if (threads_) {
+    return true;
+  }
+  for (uint32_t i = 0; i < n_threads_; i++) {
+    if (!interps_[i]->Init(schema, n_cols)) {
+      return false;
+    }
+  }
+  threads_ = new std::thread[n_threads_];
+  for (uint32_t i = 0; i < n_threads_; i++) {
+    threads_[i] = std::thread(&ParallelAggregator::WorkerLoop, this, i);
+  }
+  return true;
+}
+
+void ParallelAggregator::StopWorkers() {
+  if (threads_ == nullptr) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (uint32_t i = 0; i < n_threads_; i++) {
+    threads_[i].join();
+  }
+  delete[] threads_;
+  threads_ = nullptr;
+}
+
+bool ParallelAggregator::Process(Record* const* recs, uint32_t n) {
+  recs_ = recs;
+  rows_ = nullptr;
+  return RunRound(n);
+}
+
+bool ParallelAggregator::ProcessRows(const unsigned char* rows, uint32_t n) {
+  recs_ = nullptr;
+  rows_ = rows;
+  return RunRound(n);
+}
+
+bool ParallelAggregator::RunRound(uint32_t n) {
+  assert(threads_ != nullptr);
+  if (n == 0) {
+    return true;
+  }
+
+  /*
+   * The workers are all waiting for the next round, the queues and the
+   * rows can be set without locking.
+   */
+  uint32_t n_morsels = (n + kMorselSize - 1) / kMorselSize;
+  for (uint32_t m = 0; m < n_morsels; m++) {
+    uint32_t begin = m * kMorselSize;
+    uint32_t end = (n - begin) < kMorselSize ? n : begin + kMorselSize;
+    uint64_t owner = static_cast<uint64_t>(m) * n_threads_ / n_morsels;
+    queues_[owner].morsels.push_back(Morsel{begin, end});
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    n_running_ = n_threads_;
+    round_++;
+  }
+  work_cv_.notify_all();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return n_running_ == 0; });
+  return !failed_;
+}
+
+/*
+ * Own morsels first, from the front, then the others' from the back.
+ */
+bool ParallelAggregator::NextMorsel(uint32_t id, Morsel* morsel) {
+  for (uint32_t i = 0; i < n_threads_; i++) {
+    WorkQueue* queue = &queues_[(id + i) % n_threads_];
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->morsels.empty()) {
+      continue;
+    }
+    if (i == 0) {
+      *morsel = queue->morsels.front();
+      queue->morsels.pop_front();
+    } else {
+      *morsel = queue->morsels.back();
+      queue->morsels.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+void ParallelAggregator::WorkerLoop(uint32_t id) {
+  uint64_t round = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this, round] { return stop_ || round_ != round; });
+      if (stop_) {
+        return;
+      }
+      round = round_;
+    }
+
+    // Keep draining after a failure so the round still ends.
+    bool ok = true;
+    Morsel morsel;
+    while (NextMorsel(id, &morsel)) {
+      uint32_t n = morsel.end - morsel.begin;
+      if (rows_) {
+        ok = ok && interps_[id]->ProcessRows(
+            rows_ + static_cast<size_t>(morsel.begin) *
+                    interps_[id]->row_length(), n);
+      } else {
+        ok = ok && interps_[id]->ProcessBatch(recs_ + morsel.begin, n);
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = failed_ || !ok;
+    if (--n_running_ == 0) {
+      done_cv_.notify_one();
+    }
+  }
+}
+
+AggInterpreter* ParallelAggregator::Finish() {
+  StopWorkers();
+  // Round by round, interps_[i] takes in interps_[i + step].
+  for (uint32_t step = 1; step < n_threads_; step *= 2) {
+    uint32_t n_merges = 0;
+    std::thread* mergers = new std::thread[n_threads_ / (2 * step) + 1];
+    bool* oks = new bool[n_threads_ / (2 * step) + 1];
+    for (uint32_t i = 0; i + step < n_threads_; i += 2 * step) {
+      AggInterpreter* dst = interps_[i];
+      AggInterpreter* src = interps_[i + step];
+      bool* ok = &oks[n_merges];
+      mergers[n_merges++] = std::thread([dst, src, ok] {
+        *ok = dst->Merge(*src);
+      });
+    }
+    bool ok = true;
+    for (uint32_t i = 0; i < n_merges; i++) {
+      mergers[i].join();
+      ok = ok && oks[i];
+    }
+    delete[] mergers;
+    delete[] oks;
+    if (!ok) {
+      return nullptr;
+    }
+  }
+  return interps_[0];
+}
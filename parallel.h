@@ -0,0 +1,93 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "interpreter.h"
+
+/*
+ * Runs an aggregation program over rows on a pool of worker threads. The
+ * rows given to Process() are cut into morsels of kMorselSize rows and
+ * dealt out in contiguous runs, one per worker. A worker takes morsels from
+ * the front of its own queue and, once that's empty, steals from the back
+ * of the others', so a slow worker doesn't hold the rest up. Each worker
+ * aggregates into an AggInterpreter of its own, Finish() merges them.
+ */
+class ParallelAggregator {
+ public:
+  static const uint32_t kMorselSize = kBatchSize;
+
+  ParallelAggregator(const uint32_t* prog, uint32_t prog_len,
+                     uint32_t n_threads);
+  ~ParallelAggregator();
+
+  /*
+   * AggInterpreter::SetHaving() of every worker, given before Init().
+   */
+  void SetHaving(const uint32_t* prog, uint32_t prog_len);
+  /*
+   * Same as AggInterpreter::Init(), also starts the workers.
+   */
+  bool Init(const ColumnDef* schema = Record::schema_,
+            uint32_t n_cols = Record::n_cols);
+  VerifyError error() const {
+    return interps_[0]->error();
+  }
+  /*
+   * Aggregates |recs| on all workers and returns once they're done, so the
+   * records may be freed right after.
+   */
+  bool Process(Record* const* recs, uint32_t n);
+  /*
+   * Same with packed rows, see AggInterpreter::ProcessRows().
+   */
+  bool ProcessRows(const unsigned char* rows, uint32_t n);
+  /*
+   * Merges the results of the workers, pairwise in parallel, and returns
+   * the interpreter holding them, owned by the aggregator. nullptr if they
+   * can't be merged, see AggInterpreter::Merge(). No Process() after it.
+   */
+  AggInterpreter* Finish();
+
+ private:
+  struct Morsel {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Morsel> morsels;
+  };
+
+  void WorkerLoop(uint32_t id);
+  bool RunRound(uint32_t n);
+  bool NextMorsel(uint32_t id, Morsel* morsel);
+  void StopWorkers();
+
+  uint32_t n_threads_;
+  AggInterpreter** interps_;
+  WorkQueue* queues_;
+  std::thread* threads_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  uint64_t round_;  // bumped for every Process() call
+  uint32_t n_running_;
+  bool stop_;
+  bool failed_;
+  // Rows of the round, one of them is set.
+  Record* const* recs_;
+  const unsigned char* rows_;
+};
+
+#endif  // PARALLEL_H_
@@ -3,13 +3,59 @@
  *
  * Author: Zhao Song
  */
+#include <assert.h>
 #include <stdio.h>
 
 #include "record.h"
 
+const ColumnDef Record::schema_[Record::n_cols] = {
+  {kTypeBigInt, false, 0},
+  {kTypeDouble, false, 0},
+  {kTypeBigInt, true, 0},
+  {kTypeDouble, false, 0},
+  {kTypeBigInt, false, 0},
+  {kTypeVarchar, false, 12}
+};
+
+const uint32_t Record::col_offsets_[Record::n_cols] = {
+  0, 8, 16, 24, 32, 40
+};
+
+RowLayout::RowLayout(const ColumnDef* schema, uint32_t n_cols)
+  : schema_(schema), n_cols_(n_cols), offsets_(new uint32_t[n_cols]),
+    validity_offset_(0), length_(0) {
+  assert(n_cols <= kMaxCols);
+  for (uint32_t c = 0; c < n_cols; c++) {
+    offsets_[c] = validity_offset_;
+    validity_offset_ += EncodedWidth(schema[c]);
+  }
+  length_ = validity_offset_ + sizeof(uint64_t);
+}
+
+RowLayout::~RowLayout() {
+  delete[] offsets_;
+}
+
+void RowLayout::SetNull(unsigned char* row, uint32_t col) const {
+  uint64_t validity;
+  memcpy(&validity, row + validity_offset_, sizeof(validity));
+  validity &= ~(1ULL << col);
+  memcpy(row + validity_offset_, &validity, sizeof(validity));
+}
+
+void RowLayout::Clear(unsigned char* row) const {
+  memset(row, 0, length_);
+  uint64_t validity = n_cols_ == kMaxCols ? ~0ULL : (1ULL << n_cols_) - 1;
+  memcpy(row + validity_offset_, &validity, sizeof(validity));
+}
+
 void Record::Print() {
   printf("------Record------\n");
   for (int i = 0; i < n_cols; i++) {
+    if (cols_[i]->is_null()) {
+      printf("  column [%u], value: NULL\n", i);
+      continue;
+    }
     switch (cols_type_[i]) {
       case kTypeBigInt:
         if (cols_[i]->is_unsigned()) {
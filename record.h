@@ -8,11 +8,62 @@
 
 #include "column.h"
 
+/*
+ * Where the columns of a schema are in an encoded row: each value in its
+ * EncodedWidth() bytes, back to back in schema order, then a word whose
+ * bit c is set if column c isn't NULL. Record::buf() is the row of
+ * Record::schema_.
+ */
+class RowLayout {
+ public:
+  // Columns the validity word has a bit for.
+  static const uint32_t kMaxCols = 64;
+
+  RowLayout(const ColumnDef* schema, uint32_t n_cols);
+  ~RowLayout();
+
+  const ColumnDef& def(uint32_t col) const {
+    return schema_[col];
+  }
+  uint32_t offset(uint32_t col) const {
+    return offsets_[col];
+  }
+  // Bytes of a whole row.
+  uint32_t length() const {
+    return length_;
+  }
+  bool IsNull(const unsigned char* row, uint32_t col) const {
+    uint64_t validity;
+    memcpy(&validity, row + validity_offset_, sizeof(validity));
+    return ((validity >> col) & 1) == 0;
+  }
+  void SetNull(unsigned char* row, uint32_t col) const;
+  /*
+   * Zeroes the length() bytes of |row|, with no column NULL.
+   */
+  void Clear(unsigned char* row) const;
+
+ private:
+  const ColumnDef* schema_;
+  uint32_t n_cols_;
+  uint32_t* offsets_;
+  uint32_t validity_offset_;
+  uint32_t length_;
+};
+
 class Record {
  public:
   static const uint32_t n_cols = 6;
   static const uint32_t raw_length_ = 8 + 8 + 8 + 8 + 8 + 12;
-  static const uint32_t encoded_length_ = raw_length_ + sizeof(uint32_t);
+  // The columns, then a word whose bit c is set if column c isn't NULL.
+  static const uint32_t validity_offset_ = raw_length_ + sizeof(uint32_t);
+  static const uint32_t encoded_length_ = validity_offset_ + sizeof(uint64_t);
+  static const ColumnDef schema_[n_cols];
+  /*
+   * Where each column starts in the encoded row, see buf(). A VARCHAR is
+   * its length, 4 bytes, followed by the bytes, the last one set to NUL.
+   */
+  static const uint32_t col_offsets_[n_cols];
 
   Record(int64_t var_int, double var_double,
          uint64_t var_uint, double var_double2,
@@ -45,6 +96,32 @@ class Record {
     cols_[5] = new ColumnVarchar(var_varchar, varchar_length,
                                (unsigned char*)buf_ + pos);
     pos += cols_[5]->raw_length();
+
+    uint64_t validity = (1ULL << n_cols) - 1;
+    memcpy(buf_ + validity_offset_, &validity, sizeof(validity));
+  }
+
+  /*
+   * Rebuilds a record from a copy of the encoded_length_ bytes of buf(),
+   * e.g. read back from disk.
+   */
+  explicit Record(const unsigned char* encoded)
+    : Record(Get<int64_t>(encoded, 0), Get<double>(encoded, 8),
+             Get<uint64_t>(encoded, 16), Get<double>(encoded, 24),
+             Get<int64_t>(encoded, 32),
+             reinterpret_cast<const char*>(encoded) + 44,
+             Get<uint32_t>(encoded, 40)) {
+    for (uint32_t i = 0; i < n_cols; i++) {
+      if (IsNull(encoded, i)) {
+        SetNull(i);
+      }
+    }
+  }
+
+  ~Record() {
+    for (uint32_t i = 0; i < n_cols; i++) {
+      delete cols_[i];
+    }
   }
 
   Column* GetColumn(int col) {
@@ -55,9 +132,60 @@ class Record {
     }
   }
 
+  const unsigned char* buf() const {
+    return buf_;
+  }
+
+  /*
+   * Makes column |col| NULL, its value is left as it is.
+   */
+  void SetNull(uint32_t col) {
+    cols_[col]->set_null();
+    SetNull(buf_, col);
+  }
+  static void SetNull(unsigned char* encoded, uint32_t col) {
+    uint64_t validity = Get<uint64_t>(encoded, validity_offset_);
+    validity &= ~(1ULL << col);
+    memcpy(encoded + validity_offset_, &validity, sizeof(validity));
+  }
+  static bool IsNull(const unsigned char* encoded, uint32_t col) {
+    return ((Get<uint64_t>(encoded, validity_offset_) >> col) & 1) == 0;
+  }
+
+  /*
+   * Writes the row the constructor would hold in buf() straight into
+   * |buf| of encoded_length_ bytes, without any Column. No column is NULL,
+   * SetNull(buf, col) makes one.
+   */
+  static void Encode(int64_t var_int, double var_double,
+                     uint64_t var_uint, double var_double2,
+                     int64_t var_int_group,
+                     const char* var_varchar, uint32_t varchar_length,
+                     unsigned char* buf) {
+    memset(buf, 0, encoded_length_);
+    memcpy(buf + col_offsets_[0], &var_int, sizeof(var_int));
+    memcpy(buf + col_offsets_[1], &var_double, sizeof(var_double));
+    memcpy(buf + col_offsets_[2], &var_uint, sizeof(var_uint));
+    memcpy(buf + col_offsets_[3], &var_double2, sizeof(var_double2));
+    memcpy(buf + col_offsets_[4], &var_int_group, sizeof(var_int_group));
+    unsigned char* varchar = buf + col_offsets_[5];
+    memcpy(varchar, &varchar_length, sizeof(varchar_length));
+    memcpy(varchar + sizeof(varchar_length), var_varchar, varchar_length);
+    varchar[sizeof(varchar_length) + varchar_length - 1] = '\0';
+    uint64_t validity = (1ULL << n_cols) - 1;
+    memcpy(buf + validity_offset_, &validity, sizeof(validity));
+  }
+
   void Print();
 
  private:
+  template <typename T>
+  static T Get(const unsigned char* encoded, uint32_t pos) {
+    T value;
+    memcpy(&value, encoded + pos, sizeof(T));
+    return value;
+  }
+
   unsigned char buf_[encoded_length_];
   Column* cols_[n_cols];
   ColumnType cols_type_[n_cols];
@@ -0,0 +1,216 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+
+#include "group_table.h"
+#include "having.h"
+#include "result_cursor.h"
+#include "spill.h"
+
+ResultCursor::ResultCursor(AggInterpreter* interp, bool sorted)
+  : interp_(interp), ok_(true),
+    state_len_(interp->n_agg_results_ * sizeof(AggResItem)),
+    refs_(nullptr), n_refs_(0), next_ref_(0), own_refs_(nullptr),
+    heap_(nullptr), table_(nullptr), table_pos_(0), run_(nullptr),
+    buf_(nullptr), buf_len_(0), run_items_(nullptr), single_(false),
+    has_cur_(false), cur_key_(nullptr), cur_key_len_(0),
+    cur_aggs_(nullptr), key_bytes_needed_(0) {
+  if (interp_->n_gb_cols_ == 0) {
+    single_ = true;
+    return;
+  }
+  if (!interp_->FinishSpill()) {
+    ok_ = false;
+    return;
+  }
+  interp_->InitGroupByInfo();
+
+  if (interp_->spill_run_) {
+    run_ = interp_->spill_run_;
+    rewind(run_);
+    run_items_ = new AggResItem[interp_->n_agg_results_ + 1];
+    if (interp_->has_top_n_) {
+      // Keep copies of the top groups, the run buffer is reused.
+      heap_ = new TopNHeap(interp_->top_n_agg_, interp_->top_n_desc_,
+                           interp_->top_n_limit_, interp_->n_agg_results_);
+      while (Fetch()) {
+        heap_->Offer(reinterpret_cast<const char*>(cur_key_), cur_key_len_,
+                     cur_aggs_, true);
+      }
+      run_ = nullptr;
+      refs_ = heap_->Sorted();
+      n_refs_ = heap_->size();
+    }
+  } else if (sorted || interp_->has_top_n_) {
+    n_refs_ = interp_->ResultGroups(sorted, &own_refs_);
+    refs_ = own_refs_;
+  } else {
+    table_ = interp_->gb_table_;
+  }
+}
+
+ResultCursor::~ResultCursor() {
+  delete[] own_refs_;
+  delete heap_;
+  delete[] buf_;
+  delete[] run_items_;
+}
+
+/*
+ * Loads the next group passing HAVING from the source into cur_*.
+ */
+bool ResultCursor::Fetch() {
+  const HavingFilter* having = interp_->having_;
+  if (refs_) {
+    // Filtered already.
+    if (next_ref_ == n_refs_) {
+      return false;
+    }
+    const GroupRef& ref = refs_[next_ref_++];
+    cur_key_ = reinterpret_cast<const uint8_t*>(ref.key);
+    cur_key_len_ = ref.key_len;
+    cur_aggs_ = ref.items;
+    return true;
+  }
+  if (table_) {
+    Entry entry;
+    while (table_->Next(&table_pos_, &entry)) {
+      const AggResItem* items =
+          reinterpret_cast<const AggResItem*>(entry.ptr + entry.len);
+      if (having && !having->Pass(items)) {
+        continue;
+      }
+      cur_key_ = reinterpret_cast<const uint8_t*>(entry.ptr);
+      cur_key_len_ = entry.len;
+      cur_aggs_ = items;
+      return true;
+    }
+    return false;
+  }
+  if (run_) {
+    uint32_t key_len = 0;
+    while (ReadGroup(run_, state_len_, &buf_, &buf_len_, &key_len)) {
+      // The state is unaligned after the key, copy it out.
+      memcpy(run_items_, buf_ + key_len, state_len_);
+      if (having && !having->Pass(run_items_)) {
+        continue;
+      }
+      cur_key_ = reinterpret_cast<const uint8_t*>(buf_);
+      cur_key_len_ = key_len;
+      cur_aggs_ = run_items_;
+      return true;
+    }
+    return false;
+  }
+  if (single_) {
+    single_ = false;
+    if (having && !having->Pass(interp_->agg_results_)) {
+      return false;
+    }
+    cur_key_ = nullptr;
+    cur_key_len_ = 0;
+    cur_aggs_ = interp_->agg_results_;
+    return true;
+  }
+  return false;
+}
+
+bool ResultCursor::Next(const uint8_t** key, uint32_t* key_len,
+                        const AggResItem** aggs) {
+  if (!has_cur_ && !Fetch()) {
+    return false;
+  }
+  has_cur_ = false;
+  *key = cur_key_;
+  *key_len = cur_key_len_;
+  *aggs = cur_aggs_;
+  return true;
+}
+
+uint32_t ResultCursor::Export(ResultColumns* columns) {
+  uint32_t n_gb_cols = interp_->n_gb_cols_;
+  const GBColInfo* info = interp_->gb_cols_info_;
+  for (uint32_t i = 0; i < n_gb_cols; i++) {
+    if (info[i].type == kTypeVarchar) {
+      columns->keys[i].offsets[0] = 0;
+    }
+  }
+
+  key_bytes_needed_ = 0;
+  uint32_t rows = 0;
+  while (rows < columns->capacity && (has_cur_ || Fetch())) {
+    // Kept as current until it's copied, so a full buffer doesn't lose it.
+    has_cur_ = true;
+    bool fits = true;
+    uint32_t longest = 0;
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < n_gb_cols; i++) {
+      if (cur_key_[pos++] == kKeyNull) {
+        continue;
+      }
+      if (info[i].type == kTypeVarchar) {
+        uint32_t raw_len;
+        memcpy(&raw_len, cur_key_ + pos, sizeof(raw_len));
+        uint32_t len = raw_len ? raw_len - 1 : 0;
+        const ResultKeyColumn& col = columns->keys[i];
+        fits = fits &&
+               col.offsets[rows] + static_cast<size_t>(len) <= col.data_len;
+        longest = len > longest ? len : longest;
+        pos += sizeof(uint32_t) + raw_len;
+      } else {
+        pos += sizeof(int64_t);
+      }
+    }
+    if (!fits) {
+      if (rows == 0) {
+        // Too long for any call, not just this one.
+        key_bytes_needed_ = longest;
+      }
+      break;
+    }
+
+    pos = 0;
+    for (uint32_t i = 0; i < n_gb_cols; i++) {
+      ResultKeyColumn* col = &columns->keys[i];
+      bool is_null = cur_key_[pos++] == kKeyNull;
+      if (col->validity) {
+        uint8_t bit = 1 << (rows & 7);
+        col->validity[rows >> 3] = is_null ?
+                                   col->validity[rows >> 3] & ~bit :
+                                   col->validity[rows >> 3] | bit;
+      }
+      if (is_null) {
+        if (info[i].type == kTypeVarchar) {
+          col->offsets[rows + 1] = col->offsets[rows];
+        } else {
+          memset(col->data + rows * sizeof(int64_t), 0, sizeof(int64_t));
+        }
+      } else if (info[i].type == kTypeVarchar) {
+        uint32_t raw_len;
+        memcpy(&raw_len, cur_key_ + pos, sizeof(raw_len));
+        uint32_t len = raw_len ? raw_len - 1 : 0;
+        memcpy(col->data + col->offsets[rows],
+               cur_key_ + pos + sizeof(uint32_t), len);
+        col->offsets[rows + 1] = col->offsets[rows] + len;
+        pos += sizeof(uint32_t) + raw_len;
+      } else {
+        memcpy(col->data + rows * sizeof(int64_t), cur_key_ + pos,
+               sizeof(int64_t));
+        pos += sizeof(int64_t);
+      }
+    }
+    assert(pos == cur_key_len_);
+    for (uint32_t a = 0; a < interp_->n_agg_results_; a++) {
+      columns->aggs[a][rows] = cur_aggs_[a].value;
+      if (columns->aggs_unsigned) {
+        columns->aggs_unsigned[a][rows] = cur_aggs_[a].is_unsigned;
+      }
+    }
+    has_cur_ = false;
+    rows++;
+  }
+  return rows;
+}
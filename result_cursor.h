@@ -0,0 +1,112 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef RESULT_CURSOR_H_
+#define RESULT_CURSOR_H_
+
+#include <stdio.h>
+
+#include "interpreter.h"
+#include "topn.h"
+
+/*
+ * Group by column |i| in the buffers of ResultColumns. Numbers take 8 bytes
+ * each in |data|, as their CeilType(). VARCHAR values go back to back in
+ * |data|, which has room for |data_len| bytes, without the NUL the record
+ * ends them with; row r is [offsets[r], offsets[r + 1]). A NULL is 0 or an
+ * empty string there, with its bit of |validity| cleared.
+ */
+struct ResultKeyColumn {
+  uint8_t* data;
+  size_t data_len;
+  uint32_t* offsets;  // VARCHAR only, capacity + 1 of them
+  // Bit r % 8 of byte r / 8 is set if row r isn't NULL, nullptr if not
+  // wanted.
+  uint8_t* validity;
+};
+
+/*
+ * Buffers given by the caller to ResultCursor::Export(), a row per group.
+ */
+struct ResultColumns {
+  uint32_t capacity;
+  ResultKeyColumn* keys;  // one per group by column
+  DataValue** aggs;  // aggs[a][r]: agg result a of row r
+  bool** aggs_unsigned;  // same layout, nullptr if not wanted
+};
+
+/*
+ * Reads the results of an interpreter where they are: for each group a
+ * pointer to its key, as encoded by the record, and to its agg results,
+ * straight from the group table. HAVING and SetTopN() apply as in Print().
+ * Groups come in no particular order, unless |sorted| asks for key order,
+ * or SetTopN() for its own. Finishing spilled rows is left to the cursor,
+ * which then reads the merged run and copies each group out of it.
+ *
+ * The interpreter mustn't process rows while a cursor is open on it.
+ */
+class ResultCursor {
+ public:
+  explicit ResultCursor(AggInterpreter* interp, bool sorted = false);
+  ~ResultCursor();
+
+  /*
+   * False if the spilled rows couldn't be aggregated, there are no groups
+   * then.
+   */
+  bool ok() const {
+    return ok_;
+  }
+  /*
+   * Moves to the next group, false past the last one. The pointers stay
+   * valid until the next call. Ungrouped results are a single group with
+   * an empty key.
+   */
+  bool Next(const uint8_t** key, uint32_t* key_len, const AggResItem** aggs);
+  /*
+   * Copies the next groups into |columns| until its capacity or a VARCHAR
+   * buffer is full, and returns how many. 0 means no groups are left,
+   * unless key_bytes_needed() says the next one doesn't fit even into
+   * empty buffers.
+   */
+  uint32_t Export(ResultColumns* columns);
+  /*
+   * After an Export() returning 0 with groups left, the data_len a VARCHAR
+   * key column needs for the next group, its longest value. 0 otherwise.
+   */
+  uint32_t key_bytes_needed() const {
+    return key_bytes_needed_;
+  }
+
+ private:
+  bool Fetch();
+
+  AggInterpreter* interp_;
+  bool ok_;
+  uint32_t state_len_;
+
+  // Exactly one of these is the source.
+  const GroupRef* refs_;  // sorted or top groups
+  uint32_t n_refs_;
+  uint32_t next_ref_;
+  GroupRef* own_refs_;
+  TopNHeap* heap_;
+  const GroupTable* table_;  // walked in place
+  uint64_t table_pos_;
+  FILE* run_;  // spilled groups, in key order
+  char* buf_;
+  uint32_t buf_len_;
+  AggResItem* run_items_;
+  bool single_;  // ungrouped
+
+  // Group fetched but not handed out yet.
+  bool has_cur_;
+  const uint8_t* cur_key_;
+  uint32_t cur_key_len_;
+  const AggResItem* cur_aggs_;
+  uint32_t key_bytes_needed_;
+};
+
+#endif  // RESULT_CURSOR_H_
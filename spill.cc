@@ -0,0 +1,128 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+
+#include "group_table.h"
+#include "interpreter.h"
+#include "spill.h"
+
+SpillPartitions::SpillPartitions(uint32_t level, uint32_t row_len)
+  : level_(level), row_len_(row_len) {
+  assert(level_ < kMaxLevel);
+  for (uint32_t i = 0; i < kNumPartitions; i++) {
+    files_[i] = nullptr;
+  }
+}
+
+SpillPartitions::~SpillPartitions() {
+  for (uint32_t i = 0; i < kNumPartitions; i++) {
+    if (files_[i]) {
+      fclose(files_[i]);
+    }
+  }
+}
+
+bool SpillPartitions::Add(const char* key, uint32_t key_len,
+                          const unsigned char* row) {
+  // Top bits first, the group table itself indexes with the low ones.
+  uint64_t hash = HashGroupKey(key, key_len);
+  uint32_t i = (hash >> (60 - level_ * 4)) & (kNumPartitions - 1);
+  if (files_[i] == nullptr) {
+    files_[i] = tmpfile();
+    if (files_[i] == nullptr) {
+      return false;
+    }
+  }
+  return fwrite(row, row_len_, 1, files_[i]) == 1;
+}
+
+FILE* SpillPartitions::Partition(uint32_t i) {
+  if (files_[i] == nullptr || fflush(files_[i]) != 0) {
+    return nullptr;
+  }
+  rewind(files_[i]);
+  return files_[i];
+}
+
+uint32_t ReadRows(FILE* file, uint32_t row_len, unsigned char* buf,
+                  uint32_t n) {
+  return fread(buf, row_len, n, file);
+}
+
+bool WriteGroup(FILE* run, const char* key, uint32_t key_len,
+                const char* state, uint32_t state_len) {
+  return fwrite(&key_len, sizeof(key_len), 1, run) == 1 &&
+         fwrite(key, key_len, 1, run) == 1 &&
+         fwrite(state, state_len, 1, run) == 1;
+}
+
+bool ReadGroup(FILE* run, uint32_t state_len, char** buf, uint32_t* buf_len,
+               uint32_t* key_len) {
+  if (fread(key_len, sizeof(*key_len), 1, run) != 1) {
+    return false;
+  }
+  if (*key_len + state_len > *buf_len) {
+    delete[] *buf;
+    *buf_len = (*key_len + state_len) * 2;
+    *buf = new char[*buf_len];
+  }
+  return fread(*buf, *key_len + state_len, 1, run) == 1;
+}
+
+/*
+ * There are at most kNumPartitions + 1 runs, picking the smallest head by
+ * a linear scan is cheap enough.
+ */
+FILE* MergeRuns(FILE** runs, uint32_t n_runs, uint32_t state_len) {
+  FILE* out = tmpfile();
+  char** bufs = new char*[n_runs];
+  uint32_t* buf_lens = new uint32_t[n_runs];
+  uint32_t* key_lens = new uint32_t[n_runs];
+  bool* valid = new bool[n_runs];
+  for (uint32_t i = 0; i < n_runs; i++) {
+    bufs[i] = nullptr;
+    buf_lens[i] = 0;
+    rewind(runs[i]);
+    valid[i] = ReadGroup(runs[i], state_len, &bufs[i], &buf_lens[i],
+                         &key_lens[i]);
+  }
+
+  bool ok = (out != nullptr);
+  EntryCmp cmp;
+  while (ok) {
+    int32_t min = -1;
+    for (uint32_t i = 0; i < n_runs; i++) {
+      if (valid[i] &&
+          (min < 0 || cmp(Entry{bufs[i], key_lens[i]},
+                          Entry{bufs[min], key_lens[min]}))) {
+        min = i;
+      }
+    }
+    if (min < 0) {
+      break;
+    }
+    ok = WriteGroup(out, bufs[min], key_lens[min], bufs[min] + key_lens[min],
+                    state_len);
+    valid[min] = ReadGroup(runs[min], state_len, &bufs[min], &buf_lens[min],
+                           &key_lens[min]);
+  }
+
+  for (uint32_t i = 0; i < n_runs; i++) {
+    delete[] bufs[i];
+    fclose(runs[i]);
+  }
+  delete[] bufs;
+  delete[] buf_lens;
+  delete[] key_lens;
+  delete[] valid;
+  if (!ok || fflush(out) != 0) {
+    if (out) {
+      fclose(out);
+    }
+    return nullptr;
+  }
+  return out;
+}
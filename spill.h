@@ -0,0 +1,73 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef SPILL_H_
+#define SPILL_H_
+
+#include <stdio.h>
+
+#include "record.h"
+
+/*
+ * Rows of the groups that didn't fit in the memory budget, hash-partitioned
+ * by group key into temporary files, which are deleted once closed. Each
+ * level of spilling takes a different part of the key hash, so the rows of
+ * one partition spread out again when it has to spill once more.
+ */
+class SpillPartitions {
+ public:
+  static const uint32_t kNumPartitions = 16;
+  static const uint32_t kMaxLevel = 8;
+
+  // Rows are |row_len| bytes each.
+  SpillPartitions(uint32_t level, uint32_t row_len);
+  ~SpillPartitions();
+
+  /*
+   * Writes |row|, encoded as AggInterpreter::ProcessRows() takes it and
+   * whose group key is [key, key + key_len), to its partition. Returns
+   * false on I/O error.
+   */
+  bool Add(const char* key, uint32_t key_len, const unsigned char* row);
+  /*
+   * Rewinds partition |i| for reading back the rows with ReadRows(),
+   * nullptr if nothing went to it.
+   */
+  FILE* Partition(uint32_t i);
+
+ private:
+  uint32_t level_;
+  uint32_t row_len_;
+  FILE* files_[kNumPartitions];
+};
+
+/*
+ * Reads up to the next |n| rows of |row_len| bytes written by
+ * SpillPartitions::Add() into |buf| of n * row_len bytes, packed as for
+ * AggInterpreter::ProcessRows(). Returns how many, 0 at the end.
+ */
+uint32_t ReadRows(FILE* file, uint32_t row_len, unsigned char* buf,
+                  uint32_t n);
+
+/*
+ * A sorted run is a temporary file of groups in EntryCmp order of their
+ * keys, each written as the key length, the key and then |state_len| bytes
+ * of aggregation state.
+ */
+bool WriteGroup(FILE* run, const char* key, uint32_t key_len,
+                const char* state, uint32_t state_len);
+/*
+ * Reads the next group of |run| into |buf|, grown as needed, key first and
+ * state right after it. Returns false at the end.
+ */
+bool ReadGroup(FILE* run, uint32_t state_len, char** buf, uint32_t* buf_len,
+               uint32_t* key_len);
+/*
+ * Merges the sorted |runs|, which have no key in common, into a new sorted
+ * run and closes them. Returns nullptr on I/O error.
+ */
+FILE* MergeRuns(FILE** runs, uint32_t n_runs, uint32_t state_len);
+
+#endif  // SPILL_H_
@@ -0,0 +1,189 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "table_file.h"
+
+namespace {
+
+const uint32_t kHeaderLen = 4 * sizeof(uint32_t) + sizeof(uint64_t);
+const uint32_t kColumnLen = 2 * sizeof(uint32_t);
+
+uint32_t DataOffset(uint32_t n_cols) {
+  uint32_t len = kHeaderLen + n_cols * kColumnLen;
+  return (len + kTableAlign - 1) / kTableAlign * kTableAlign;
+}
+
+template <typename T>
+T Get(const unsigned char* p) {
+  T value;
+  memcpy(&value, p, sizeof(T));
+  return value;
+}
+
+}  // namespace
+
+TableWriter::TableWriter(const ColumnDef* schema, uint32_t n_cols)
+  : schema_(schema), n_cols_(n_cols), layout_(schema, n_cols),
+    file_(nullptr), n_rows_(0) {
+}
+
+TableWriter::~TableWriter() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+bool TableWriter::WriteHeader() {
+  unsigned char buf[kTableAlign];
+  uint32_t header[4] = {kTableMagic << 16 | kTableVersion, n_cols_,
+                        layout_.length(), DataOffset(n_cols_)};
+  memcpy(buf, header, sizeof(header));
+  memcpy(buf + sizeof(header), &n_rows_, sizeof(n_rows_));
+  if (fseek(file_, 0, SEEK_SET) != 0 ||
+      fwrite(buf, kHeaderLen, 1, file_) != 1) {
+    return false;
+  }
+  for (uint32_t c = 0; c < n_cols_; c++) {
+    memset(buf, 0, kColumnLen);
+    buf[0] = static_cast<unsigned char>(schema_[c].type);
+    buf[1] = schema_[c].is_unsigned;
+    memcpy(buf + sizeof(uint32_t), &schema_[c].length, sizeof(uint32_t));
+    if (fwrite(buf, kColumnLen, 1, file_) != 1) {
+      return false;
+    }
+  }
+  uint32_t pad = DataOffset(n_cols_) - kHeaderLen - n_cols_ * kColumnLen;
+  memset(buf, 0, pad);
+  return pad == 0 || fwrite(buf, pad, 1, file_) == 1;
+}
+
+bool TableWriter::Open(const char* path) {
+  assert(file_ == nullptr);
+  file_ = fopen(path, "wb");
+  return file_ != nullptr && WriteHeader();
+}
+
+bool TableWriter::Append(const unsigned char* rows, uint32_t n) {
+  if (n && fwrite(rows, layout_.length(), n, file_) != n) {
+    return false;
+  }
+  n_rows_ += n;
+  return true;
+}
+
+bool TableWriter::Close() {
+  if (file_ == nullptr) {
+    return false;
+  }
+  bool ok = WriteHeader();
+  ok = fclose(file_) == 0 && ok;
+  file_ = nullptr;
+  return ok;
+}
+
+TableFile::TableFile()
+  : fd_(-1), data_(nullptr), len_(0), n_cols_(0), schema_(nullptr),
+    layout_(nullptr), n_rows_(0), row_len_(0), rows_(nullptr) {
+}
+
+TableFile::~TableFile() {
+  if (data_) {
+    munmap(const_cast<unsigned char*>(data_), len_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  delete layout_;
+  delete[] schema_;
+}
+
+bool TableFile::Open(const char* path) {
+  assert(fd_ < 0);
+  fd_ = open(path, O_RDONLY);
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < kHeaderLen) {
+    return false;
+  }
+  len_ = st.st_size;
+  void* data = mmap(nullptr, len_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<const unsigned char*>(data);
+
+  uint32_t n_cols = Get<uint32_t>(data_ + 4);
+  uint32_t row_len = Get<uint32_t>(data_ + 8);
+  uint32_t data_offset = Get<uint32_t>(data_ + 12);
+  uint64_t n_rows = Get<uint64_t>(data_ + 16);
+  if (Get<uint32_t>(data_) != (kTableMagic << 16 | kTableVersion) ||
+      n_cols == 0 || n_cols > RowLayout::kMaxCols ||
+      data_offset != DataOffset(n_cols) || data_offset > len_ ||
+      row_len == 0 || n_rows > (len_ - data_offset) / row_len) {
+    return false;
+  }
+  schema_ = new ColumnDef[n_cols];
+  for (uint32_t c = 0; c < n_cols; c++) {
+    const unsigned char* col = data_ + kHeaderLen + c * kColumnLen;
+    if (col[0] < kTypeTinyInt || col[0] > kTypeVarchar || col[1] > 1) {
+      return false;
+    }
+    schema_[c] = {static_cast<ColumnType>(col[0]), col[1] == 1,
+                  Get<uint32_t>(col + sizeof(uint32_t))};
+  }
+  layout_ = new RowLayout(schema_, n_cols);
+  if (layout_->length() != row_len) {
+    return false;
+  }
+  madvise(data, len_, MADV_SEQUENTIAL);
+  n_cols_ = n_cols;
+  n_rows_ = n_rows;
+  row_len_ = row_len;
+  rows_ = data_ + data_offset;
+  return true;
+}
+
+bool TableFile::ValidRows(uint64_t first, uint32_t n) const {
+  assert(first + n <= n_rows_);
+  for (uint32_t c = 0; c < n_cols_; c++) {
+    if (schema_[c].type != kTypeVarchar) {
+      continue;
+    }
+    const unsigned char* row = rows_ + first * row_len_;
+    for (uint32_t r = 0; r < n; r++, row += row_len_) {
+      if (layout_->IsNull(row, c)) {
+        continue;
+      }
+      const unsigned char* value = row + layout_->offset(c);
+      uint32_t raw_len = Get<uint32_t>(value);
+      if (raw_len == 0 || raw_len > schema_[c].length ||
+          value[sizeof(raw_len) + raw_len - 1] != '\0') {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool TableFile::SchemaIs(const ColumnDef* schema, uint32_t n_cols) const {
+  if (n_cols != n_cols_) {
+    return false;
+  }
+  for (uint32_t c = 0; c < n_cols; c++) {
+    if (schema[c].type != schema_[c].type ||
+        schema[c].is_unsigned != schema_[c].is_unsigned ||
+        (schema[c].type == kTypeVarchar &&
+         schema[c].length != schema_[c].length)) {
+      return false;
+    }
+  }
+  return true;
+}
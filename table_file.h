@@ -0,0 +1,115 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef TABLE_FILE_H_
+#define TABLE_FILE_H_
+
+#include <stdio.h>
+
+#include "record.h"
+
+/*
+ * A table file holds rows in binary, encoded as
+ * AggInterpreter::ProcessRows() takes them, so a mapped file is aggregated
+ * where it is:
+ *
+ *   [0x0724 << 16 | version] [n_cols] [row_len] [data_offset] [n_rows, 8 bytes]
+ *   n_cols x ([type, 1 byte] [is_unsigned, 1 byte] [0, 2 bytes] [length])
+ *   zeroes up to data_offset, a multiple of kTableAlign
+ *   n_rows x row_len bytes of rows, laid out by the RowLayout of the schema
+ *
+ * Numbers are little endian, 4 bytes unless noted.
+ */
+const uint32_t kTableMagic = 0x0724;
+const uint32_t kTableVersion = 1;
+// Rows start at a cache line, mmap() puts the file at a page.
+const uint32_t kTableAlign = 64;
+
+/*
+ * Writes a table file of |schema|, the rows given to Append() in order.
+ */
+class TableWriter {
+ public:
+  TableWriter(const ColumnDef* schema, uint32_t n_cols);
+  ~TableWriter();
+
+  /*
+   * Creates or truncates |path| and writes the header. False on I/O error,
+   * as for the others.
+   */
+  bool Open(const char* path);
+  bool Append(const unsigned char* rows, uint32_t n);
+  /*
+   * Writes the number of rows into the header and closes the file.
+   */
+  bool Close();
+  uint32_t row_length() const {
+    return layout_.length();
+  }
+
+ private:
+  bool WriteHeader();
+
+  const ColumnDef* schema_;
+  uint32_t n_cols_;
+  RowLayout layout_;
+  FILE* file_;
+  uint64_t n_rows_;
+};
+
+/*
+ * A table file mapped read only. The rows are used in place. Open() checks
+ * the header only: a VARCHAR length in a row is trusted by the interpreter
+ * and has to pass ValidRows() first.
+ */
+class TableFile {
+ public:
+  TableFile();
+  ~TableFile();
+
+  /*
+   * Maps |path|, false if it can't be read or isn't a well formed table
+   * file of this version.
+   */
+  bool Open(const char* path);
+
+  uint32_t n_cols() const {
+    return n_cols_;
+  }
+  const ColumnDef* schema() const {
+    return schema_;
+  }
+  uint64_t n_rows() const {
+    return n_rows_;
+  }
+  uint32_t row_length() const {
+    return row_len_;
+  }
+  const unsigned char* rows() const {
+    return rows_;
+  }
+  /*
+   * Whether the schema is |schema|, VARCHAR lengths included.
+   */
+  bool SchemaIs(const ColumnDef* schema, uint32_t n_cols) const;
+  /*
+   * Whether rows [first, first + n) hold VARCHAR values that fit their
+   * column, 1 to length bytes ending with the NUL, or NULL.
+   */
+  bool ValidRows(uint64_t first, uint32_t n) const;
+
+ private:
+  int fd_;
+  const unsigned char* data_;
+  size_t len_;
+  uint32_t n_cols_;
+  ColumnDef* schema_;
+  RowLayout* layout_;
+  uint64_t n_rows_;
+  uint32_t row_len_;
+  const unsigned char* rows_;
+};
+
+#endif  // TABLE_FILE_H_
@@ -0,0 +1,114 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include <assert.h>
+#include <algorithm>
+
+#include "topn.h"
+
+namespace {
+
+const uint32_t kInitialCapacity = 64;
+
+}  // namespace
+
+int CompareAggResult(const AggResItem& a, const AggResItem& b) {
+  if (a.type == kTypeDouble) {
+    return (a.value.val_double > b.value.val_double) -
+           (a.value.val_double < b.value.val_double);
+  }
+  assert(a.type == kTypeBigInt);
+  // A BIGINT result turns unsigned once it outgrows the signed range.
+  bool a_neg = !a.is_unsigned && a.value.val_int64 < 0;
+  bool b_neg = !b.is_unsigned && b.value.val_int64 < 0;
+  if (a_neg != b_neg) {
+    return a_neg ? -1 : 1;
+  }
+  if (a_neg) {
+    return (a.value.val_int64 > b.value.val_int64) -
+           (a.value.val_int64 < b.value.val_int64);
+  }
+  return (a.value.val_uint64 > b.value.val_uint64) -
+         (a.value.val_uint64 < b.value.val_uint64);
+}
+
+TopNHeap::TopNHeap(uint32_t agg_index, bool descending, uint32_t limit,
+                   uint32_t n_items)
+  : agg_index_(agg_index), descending_(descending), limit_(limit),
+    n_items_(n_items), heap_(nullptr), size_(0), capacity_(0) {
+  assert(agg_index_ < n_items_);
+}
+
+TopNHeap::~TopNHeap() {
+  for (uint32_t i = 0; i < size_; i++) {
+    delete[] heap_[i].copy;
+  }
+  delete[] heap_;
+}
+
+bool TopNHeap::Better(const GroupRef& a, const GroupRef& b) const {
+  int cmp = CompareAggResult(a.items[agg_index_], b.items[agg_index_]);
+  if (cmp != 0) {
+    return descending_ ? cmp > 0 : cmp < 0;
+  }
+  return EntryCmp()(Entry{const_cast<char*>(a.key), a.key_len},
+                    Entry{const_cast<char*>(b.key), b.key_len});
+}
+
+/*
+ * Doubles the heap, up to |limit_| groups.
+ */
+void TopNHeap::Grow() {
+  uint32_t capacity = capacity_ == 0 ? kInitialCapacity :
+                      capacity_ > limit_ / 2 ? limit_ : capacity_ * 2;
+  if (capacity > limit_) {
+    capacity = limit_;
+  }
+  GroupRef* heap = new GroupRef[capacity];
+  std::copy(heap_, heap_ + size_, heap);
+  delete[] heap_;
+  heap_ = heap;
+  capacity_ = capacity;
+}
+
+void TopNHeap::Offer(const char* key, uint32_t key_len,
+                     const AggResItem* items, bool copy) {
+  if (limit_ == 0) {
+    return;
+  }
+  GroupRef group = {key, key_len, items, nullptr};
+  auto better = [this](const GroupRef& a, const GroupRef& b) {
+    return Better(a, b);
+  };
+  if (size_ == limit_) {
+    if (!Better(group, heap_[0])) {
+      return;
+    }
+    std::pop_heap(heap_, heap_ + size_, better);
+    delete[] heap_[--size_].copy;
+  }
+  if (copy) {
+    // Results first, they need the alignment.
+    uint32_t items_len = n_items_ * sizeof(AggResItem);
+    group.copy = new char[items_len + key_len];
+    memcpy(group.copy, items, items_len);
+    memcpy(group.copy + items_len, key, key_len);
+    group.items = reinterpret_cast<AggResItem*>(group.copy);
+    group.key = group.copy + items_len;
+  }
+  if (size_ == capacity_) {
+    Grow();
+  }
+  heap_[size_++] = group;
+  std::push_heap(heap_, heap_ + size_, better);
+}
+
+const GroupRef* TopNHeap::Sorted() {
+  std::sort_heap(heap_, heap_ + size_,
+                 [this](const GroupRef& a, const GroupRef& b) {
+                   return Better(a, b);
+                 });
+  return heap_;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef TOPN_H_
+#define TOPN_H_
+
+#include "interpreter.h"
+
+/*
+ * A group handed out of the interpreter: its key and agg results. |copy|
+ * owns both if they had to be copied.
+ */
+struct GroupRef {
+  const char* key;
+  uint32_t key_len;
+  const AggResItem* items;
+  char* copy;
+};
+
+/*
+ * Keeps the |limit| best of the groups offered, ordered by agg result
+ * |agg_index|, ascending or descending, and by key on ties. A max-heap on
+ * that order holds them, so its top is the worst one kept, and a group not
+ * better than it is dropped after one comparison. The heap grows with the
+ * groups kept, so a limit above the number of groups costs nothing.
+ */
+class TopNHeap {
+ public:
+  TopNHeap(uint32_t agg_index, bool descending, uint32_t limit,
+           uint32_t n_items);
+  ~TopNHeap();
+
+  /*
+   * Offers a group. With |copy| it's copied if kept, otherwise |key| and
+   * |items| must outlive the heap.
+   */
+  void Offer(const char* key, uint32_t key_len, const AggResItem* items,
+             bool copy);
+  /*
+   * Sorts the groups kept, best first, and returns them, size() of them.
+   * No more Offer() after it.
+   */
+  const GroupRef* Sorted();
+  uint32_t size() const {
+    return size_;
+  }
+
+ private:
+  bool Better(const GroupRef& a, const GroupRef& b) const;
+  void Grow();
+
+  uint32_t agg_index_;
+  bool descending_;
+  uint32_t limit_;
+  uint32_t n_items_;
+  GroupRef* heap_;
+  uint32_t size_;
+  uint32_t capacity_;
+};
+
+/*
+ * <0, 0 or >0 as |a| is less than, equal to or greater than |b|, both agg
+ * results of the same type.
+ */
+int CompareAggResult(const AggResItem& a, const AggResItem& b);
+
+#endif  // TOPN_H_
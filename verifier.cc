@@ -0,0 +1,162 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#include "verifier.h"
+
+namespace {
+
+/*
+ * What a register is inferred to hold.
+ */
+struct RegType {
+  bool inited;
+  DataType type;
+  bool is_unsigned;
+};
+
+bool IsNumeric(DataType type) {
+  return type == kTypeBigInt || type == kTypeDouble;
+}
+
+bool IsLoadable(DataType type) {
+  return type >= kTypeTinyInt && type <= kTypeDouble;
+}
+
+}  // namespace
+
+VerifyError VerifyProgram(const uint32_t* prog, uint32_t prog_len,
+                          const ColumnDef* schema, uint32_t n_cols) {
+  if (n_cols > RowLayout::kMaxCols) {
+    return kVerifyBadSchema;
+  }
+
+  /*
+   * 1. Header.
+   */
+  if (prog_len < 2 || ((prog[0] & 0xFFFF0000) >> 16) != 0x0721 ||
+      (prog[0] & 0xFFFF) != prog_len) {
+    return kVerifyBadHeader;
+  }
+  uint32_t n_gb_cols = (prog[1] >> 16) & 0xFFFF;
+  uint32_t n_aggs = prog[1] & 0xFFFF;
+  uint32_t pos = 2;
+  if (pos + n_gb_cols + n_aggs > prog_len) {
+    return kVerifyBadHeader;
+  }
+  for (uint32_t i = 0; i < n_gb_cols; i++) {
+    if (prog[pos++] >= n_cols) {
+      return kVerifyBadGroupByCol;
+    }
+  }
+  const uint32_t* agg_types = prog + pos;
+  for (uint32_t i = 0; i < n_aggs; i++) {
+    // COUNT leaves its result type unset until the first row.
+    if (!IsNumeric(prog[pos]) && prog[pos] != kTypeUnknown) {
+      return kVerifyBadAggType;
+    }
+    pos++;
+  }
+
+  /*
+   * 2. Instructions.
+   */
+  RegType regs[kRegTotal];
+  for (uint32_t i = 0; i < kRegTotal; i++) {
+    regs[i].inited = false;
+  }
+  for (; pos < prog_len; pos++) {
+    Instruction inst;
+    DecodeInstruction(prog[pos], &inst);
+    switch (inst.op) {
+      case kOpPlus:
+      case kOpMinus:
+      case kOpMul:
+      case kOpDiv:
+      case kOpMod: {
+        if (inst.reg >= kRegTotal || inst.reg2 >= kRegTotal) {
+          return kVerifyBadReg;
+        }
+        RegType* a = &regs[inst.reg];
+        const RegType& b = regs[inst.reg2];
+        if (!a->inited || !b.inited) {
+          return kVerifyUninitReg;
+        }
+        if (a->type != inst.type || a->is_unsigned != inst.is_unsigned ||
+            b.type != inst.type2 || b.is_unsigned != inst.is_unsigned2) {
+          return kVerifyOperandMismatch;
+        }
+        if (a->type == kTypeDouble || b.type == kTypeDouble) {
+          a->type = kTypeDouble;
+          a->is_unsigned = false;
+        } else {
+          a->is_unsigned = a->is_unsigned || b.is_unsigned;
+        }
+        break;
+      }
+      case kOpMov:
+        if (inst.reg >= kRegTotal || inst.reg2 >= kRegTotal) {
+          return kVerifyBadReg;
+        }
+        if (!regs[inst.reg2].inited) {
+          return kVerifyUninitReg;
+        }
+        regs[inst.reg] = regs[inst.reg2];
+        break;
+      case kOpLoadCol:
+        if (inst.reg >= kRegTotal) {
+          return kVerifyBadReg;
+        }
+        if (inst.index >= n_cols) {
+          return kVerifyBadCol;
+        }
+        if (!IsLoadable(schema[inst.index].type) ||
+            inst.type != schema[inst.index].type ||
+            inst.is_unsigned != schema[inst.index].is_unsigned) {
+          return kVerifyColTypeMismatch;
+        }
+        regs[inst.reg].inited = true;
+        regs[inst.reg].type = CeilType(inst.type);
+        regs[inst.reg].is_unsigned = inst.is_unsigned;
+        break;
+      case kOpSum:
+      case kOpMax:
+      case kOpMin:
+      case kOpCount: {
+        if (inst.reg >= kRegTotal) {
+          return kVerifyBadReg;
+        }
+        if (!regs[inst.reg].inited) {
+          return kVerifyUninitReg;
+        }
+        if (inst.index >= n_aggs) {
+          return kVerifyBadAggIndex;
+        }
+        DataType agg_type = agg_types[inst.index];
+        DataType reg_type = regs[inst.reg].type;
+        if (inst.op == kOpCount) {
+          if (agg_type != kTypeUnknown && agg_type != kTypeBigInt) {
+            return kVerifyAggTypeMismatch;
+          }
+          break;
+        }
+        if (inst.type != agg_type || !IsNumeric(agg_type)) {
+          return kVerifyAggTypeMismatch;
+        }
+        // A DOUBLE sum takes BIGINTs too, everything else needs equal types.
+        if (reg_type != agg_type &&
+            !(inst.op == kOpSum && agg_type == kTypeDouble)) {
+          return kVerifyAggTypeMismatch;
+        }
+        break;
+      }
+      case kOpUnknown:
+      case kOpStore:
+        break;
+      default:
+        return kVerifyBadOp;
+    }
+  }
+  return kVerifyOk;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright [2024] <Copyright Hopsworks AB>
+ *
+ * Author: Zhao Song
+ */
+#ifndef VERIFIER_H_
+#define VERIFIER_H_
+
+#include "interpreter.h"
+
+/*
+ * Type-checks the program |prog| against the columns in |schema| once, so
+ * the interpreter can run it without checking anything per row:
+ *   1. The header is well formed, group by columns exist and aggregation
+ *      results are BIGINT or DOUBLE.
+ *   2. Every register is written before read. Its type is inferred from the
+ *      LOADCOLs and the arithmetic on it, and must match the operand types
+ *      encoded in each arithmetic instruction.
+ *   3. LOADCOL reads an existing numeric column as its schema type, into
+ *      a register of its CeilType().
+ *   4. Aggregations refer to an existing result of their encoded type, and
+ *      the register fits that result as Sum()/Min()/Max() expect.
+ * Returns kVerifyOk or the first error found.
+ */
+VerifyError VerifyProgram(const uint32_t* prog, uint32_t prog_len,
+                          const ColumnDef* schema, uint32_t n_cols);
+
+#endif  // VERIFIER_H_